@@ -0,0 +1,559 @@
+// Micro-benchmarks for gen-arena.
+// Results are printed as ns/op, so run this on an otherwise idle machine with optimizations enabled.
+// On Linux, hardware counters (cycles, instructions, cache/TLB/branch misses) are also printed per op,
+// if perf_event_open() is allowed (see /proc/sys/kernel/perf_event_paranoid).
+
+#include <gen_arena.h>
+#include <gen_arena_cache.h>
+#include <gen_arena_handle.h>
+#include <gen_arena_query.h>
+#include <gen_arena_secondary_map.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct Item {
+    uint32_t a, b, c, d;
+
+    Item(uint32_t v) : a(v), b(v), c(v), d(v) {}
+};
+
+template <>
+inline constexpr uint32_t gen_arena_type_id<Item>() { return 1; }
+
+// Keeps the optimizer from throwing away the benchmarked work
+static volatile uint64_t g_sink;
+
+// Hardware counters of this thread, opened with perf_event_open(). Counters that can't be opened are skipped (and printed as "-").
+class PerfCounters {
+public:
+    static constexpr int COUNT = 6;
+
+private:
+    int _fds[COUNT];
+
+public:
+    PerfCounters() {
+        for (int i = 0; i < COUNT; i++) _fds[i] = -1;
+#ifdef __linux__
+        const uint64_t cache_miss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        const uint32_t types[COUNT] = {
+                PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE,
+        };
+        const uint64_t configs[COUNT] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_L1D | cache_miss,
+                PERF_COUNT_HW_CACHE_LL | cache_miss, PERF_COUNT_HW_CACHE_DTLB | cache_miss, PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        for (int i = 0; i < COUNT; i++) {
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            _fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int i = 0; i < COUNT; i++) {
+            if (_fds[i] >= 0) close(_fds[i]);
+        }
+#endif
+    }
+
+    static const char* name(int i) {
+        static const char* names[COUNT] = {"cycles", "instrs", "L1d-miss", "LLC-miss", "dTLB-miss", "br-miss"};
+        return names[i];
+    }
+
+    bool any() const {
+        for (int i = 0; i < COUNT; i++) {
+            if (_fds[i] >= 0) return true;
+        }
+        return false;
+    }
+
+    void start() {
+#ifdef __linux__
+        for (int i = 0; i < COUNT; i++) {
+            if (_fds[i] < 0) continue;
+            ioctl(_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // Stops counting, and writes the counts (or -1 for unavailable counters).
+    void stop(int64_t* counts) {
+        for (int i = 0; i < COUNT; i++) {
+            counts[i] = -1;
+#ifdef __linux__
+            if (_fds[i] < 0) continue;
+            ioctl(_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t value;
+            if (read(_fds[i], &value, sizeof(value)) == (ssize_t) sizeof(value)) counts[i] = (int64_t) value;
+#endif
+        }
+    }
+};
+
+static PerfCounters& perf_counters() {
+    static PerfCounters counters;
+    return counters;
+}
+
+static void print_header() {
+    printf("%-48s %11s", "", "ns/op");
+    for (int i = 0; i < PerfCounters::COUNT; i++) {
+        printf(" %10s", PerfCounters::name(i));
+    }
+    printf("\n");
+    if (!perf_counters().any()) {
+        printf("(hardware counters are unavailable, check /proc/sys/kernel/perf_event_paranoid)\n");
+    }
+}
+
+template <class Fun>
+static void bench(const char* name, uint32_t ops, Fun&& fun) {
+    PerfCounters& counters = perf_counters();
+    int64_t counts[PerfCounters::COUNT];
+
+    counters.start();
+    auto start = std::chrono::steady_clock::now();
+    fun();
+    auto end = std::chrono::steady_clock::now();
+    counters.stop(counts);
+
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    printf("%-48s %8.2f ns", name, ns / ops);
+    for (int i = 0; i < PerfCounters::COUNT; i++) {
+        if (counts[i] < 0) {
+            printf(" %10s", "-");
+        } else {
+            printf(" %10.2f", (double) counts[i] / ops);
+        }
+    }
+    printf("\n");
+}
+
+// Insert / get / release throughput of a single arena configuration
+template <class Config>
+static void bench_config(const char* config_name, uint32_t count) {
+    char name[128];
+    std::vector<typename GenArena<Item, Config>::Ref> refs(count);
+    GenArena<Item, Config> arena;
+
+    snprintf(name, sizeof(name), "%s insert", config_name);
+    bench(name, count, [&]() {
+        for (uint32_t i = 0; i < count; i++) {
+            refs[i] = arena.emplace(i).first;
+        }
+    });
+
+    std::vector<typename GenArena<Item, Config>::Ref> shuffled = refs;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1234));
+
+    snprintf(name, sizeof(name), "%s get (random)", config_name);
+    bench(name, count, [&]() {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            sum += arena.get(shuffled[i])->a;
+        }
+        g_sink = sum;
+    });
+
+    snprintf(name, sizeof(name), "%s get_pipelined (random)", config_name);
+    bench(name, count, [&]() {
+        uint64_t sum = 0;
+        arena.get_pipelined(shuffled.data(), count, [&](typename GenArena<Item, Config>::Ref, Item& item) { sum += item.a; });
+        g_sink = sum;
+    });
+
+    snprintf(name, sizeof(name), "%s foreach_val", config_name);
+    bench(name, count, [&]() {
+        uint64_t sum = 0;
+        arena.foreach_val([&](Item& item) { sum += item.a; });
+        g_sink = sum;
+    });
+
+    snprintf(name, sizeof(name), "%s release (random)", config_name);
+    bench(name, count, [&]() {
+        for (uint32_t i = 0; i < count; i++) {
+            arena.release(shuffled[i]);
+        }
+    });
+}
+
+// Churn (releasing a random item and inserting a new one) in a half full arena, with each reuse policy.
+// The cache misses per op show how cold the reused sparse entries are, and the sparse size how many slots the quarantine costs.
+static void bench_reuse_policies(uint32_t count, uint32_t ops) {
+    const GenArenaReusePolicy policies[] = {
+            {GenArenaReuseOrder::Fifo, 0},
+            {GenArenaReuseOrder::Lifo, 0},
+            {GenArenaReuseOrder::Fifo, 1024},
+    };
+    const char* names[] = {"FIFO", "LIFO", "FIFO, quarantine 1024"};
+
+    std::vector<uint32_t> victims(ops);
+    std::mt19937 rng(1234);
+    for (uint32_t i = 0; i < ops; i++) victims[i] = rng() % count;
+
+    for (int k = 0; k < 3; k++) {
+        GenArena<Item> arena;
+        arena.set_reuse_policy(policies[k]);
+        std::vector<GenArena<Item>::Ref> refs(2 * count);
+        for (uint32_t i = 0; i < 2 * count; i++) {
+            refs[i] = arena.emplace(i).first;
+        }
+        // Release a random half, so that the free list holds count slots in random order
+        std::shuffle(refs.begin(), refs.end(), std::mt19937(1234));
+        for (uint32_t i = count; i < 2 * count; i++) {
+            arena.release(refs[i]);
+        }
+        refs.resize(count);
+
+        char name[128];
+        snprintf(name, sizeof(name), "churn (%s)", names[k]);
+        bench(name, ops, [&]() {
+            for (uint32_t i = 0; i < ops; i++) {
+                uint32_t victim = victims[i];
+                arena.release(refs[victim]);
+                refs[victim] = arena.emplace(i).first;
+            }
+        });
+        printf("%-48s %8u slots\n", "  sparse size", arena.raw().free_list_size());
+    }
+}
+
+// Attaching data to a subset of refs, with the secondary maps and with std::unordered_map
+template <class Map>
+static void bench_secondary_map(const char* map_name, Map& map, const std::vector<GenArenaRef<>>& refs) {
+    char name[128];
+    uint32_t count = (uint32_t) refs.size();
+
+    snprintf(name, sizeof(name), "%s insert", map_name);
+    bench(name, count, [&]() {
+        for (uint32_t i = 0; i < count; i++) {
+            map.insert(refs[i], Item(i));
+        }
+    });
+
+    std::vector<GenArenaRef<>> shuffled = refs;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1234));
+
+    snprintf(name, sizeof(name), "%s lookup (random)", map_name);
+    bench(name, count, [&]() {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            sum += map.try_get(shuffled[i])->a;
+        }
+        g_sink = sum;
+    });
+
+    snprintf(name, sizeof(name), "%s iterate", map_name);
+    bench(name, count, [&]() {
+        uint64_t sum = 0;
+        map.foreach_ref_val([&](GenArenaRef<> ref, Item& item) { sum += item.a; });
+        g_sink = sum;
+    });
+}
+
+// Minimal adapter giving std::unordered_map the same interface, keyed by the packed ref
+struct UnorderedSecondaryMap {
+    std::unordered_map<uint64_t, Item> map;
+
+    void insert(GenArenaRef<> ref, const Item& item) { map.emplace(ref.value, item); }
+
+    Item* try_get(GenArenaRef<> ref) {
+        auto it = map.find(ref.value);
+        return it == map.end() ? nullptr : &it->second;
+    }
+
+    template <class Fun>
+    void foreach_ref_val(Fun&& fun) {
+        for (auto& kv: map) fun(GenArenaRef<>{kv.first}, kv.second);
+    }
+};
+
+static void bench_secondary_maps(uint32_t count) {
+    // Attach data to every other ref of a primary arena
+    GenArena<Item> arena;
+    std::vector<GenArenaRef<>> refs;
+    for (uint32_t i = 0; i < 2 * count; i++) {
+        auto ref = arena.emplace(i).first;
+        if (i % 2 == 0) refs.push_back(ref);
+    }
+
+    GenSecondaryMap<Item> sparse;
+    bench_secondary_map("GenSecondaryMap", sparse, refs);
+    GenDenseSecondaryMap<Item> dense;
+    bench_secondary_map("GenDenseSecondaryMap", dense, refs);
+    UnorderedSecondaryMap unordered;
+    bench_secondary_map("std::unordered_map", unordered, refs);
+}
+
+// Joining two arenas that share a handle space, against probing the second arena by hand
+static void bench_join(uint32_t count) {
+    GenHandleAllocator<> entities;
+    entities.setup(count);
+    std::vector<GenArenaRef<>> refs(count);
+    entities.allocate_batch(refs.data(), count);
+    std::shuffle(refs.begin(), refs.end(), std::mt19937(1234));
+
+    GenArena<Item> a;
+    GenArena<uint64_t> b;
+    for (uint32_t i = 0; i < count; i++) {
+        a.emplace_at(refs[i], i);
+        if (i % 2 == 0) b.emplace_at(refs[(i * 7) % count], i);
+    }
+
+    bench("join (nested try_get)", b.size(), [&]() {
+        uint64_t sum = 0;
+        b.foreach_ref_val([&](GenArena<uint64_t>::Ref ref, uint64_t& value) {
+            const Item* item = a.try_get(GenArena<Item>::Ref(ref));
+            if (item) sum += item->a + value;
+        });
+        g_sink = sum;
+    });
+
+    bench("join (gen_arena_join)", b.size(), [&]() {
+        uint64_t sum = 0;
+        gen_arena_join([&](GenArenaRef<> ref, Item& item, uint64_t& value) { sum += item.a + value; }, a, b);
+        g_sink = sum;
+    });
+
+    entities.release();
+}
+
+// A bump allocator over one big block, which frees everything at once in reset()
+struct BumpAllocator {
+    std::vector<unsigned char> block;
+    size_t offset = 0;
+
+    static void* allocate(void* ctx, size_t size, size_t alignment) {
+        BumpAllocator* self = static_cast<BumpAllocator*>(ctx);
+        size_t begin = (self->offset + alignment - 1) & ~(alignment - 1);
+        if (begin + size > self->block.size()) return nullptr;
+        self->offset = begin + size;
+        return self->block.data() + begin;
+    }
+
+    static void deallocate(void*, void*, size_t, size_t) {}
+
+    void reset() { offset = 0; }
+};
+
+// Setting up, filling and tearing down many small arenas (like per-level or per-frame containers)
+static void bench_small_arenas(uint32_t arena_count, uint32_t items_per_arena) {
+    char name[128];
+    const uint32_t ops = arena_count * items_per_arena;
+
+    // GenArena isn't copyable, so allocate them all at once up front
+    std::unique_ptr<GenArena<Item>[]> arenas(new GenArena<Item>[arena_count]);
+
+    auto fill_and_release = [&]() {
+        for (uint32_t k = 0; k < arena_count; k++) {
+            for (uint32_t i = 0; i < items_per_arena; i++) {
+                arenas[k].emplace(i);
+            }
+        }
+        uint64_t sum = 0;
+        for (uint32_t k = 0; k < arena_count; k++) {
+            sum += arenas[k].size();
+            arenas[k].release();
+        }
+        g_sink = sum;
+    };
+
+    snprintf(name, sizeof(name), "%u arenas x %u items (default allocator)", arena_count, items_per_arena);
+    bench(name, ops, fill_and_release);
+
+    BumpAllocator bump;
+    // Enough for all the buffers that the arenas grow through (items, metadata and free list nodes)
+    bump.block.resize((size_t) 8 * ops * sizeof(Item));
+    GenArenaAllocator allocator = {&BumpAllocator::allocate, &BumpAllocator::deallocate, &bump};
+    snprintf(name, sizeof(name), "%u arenas x %u items (bump allocator)", arena_count, items_per_arena);
+    bench(name, ops, [&]() {
+        for (uint32_t k = 0; k < arena_count; k++) {
+            arenas[k].setup(0, &allocator);
+        }
+        fill_and_release();
+        bump.reset();
+    });
+}
+
+// Doubling the capacity of a full arena. With the default allocator on Linux, big buffers are grown with mremap(),
+// while a custom allocator always copies (even though it just forwards to gen_arena_aligned_alloc)
+static void bench_growth(uint32_t count) {
+    GenArenaAllocator copying = {&gen_arena_default_allocate, &gen_arena_default_deallocate, nullptr};
+    const GenArenaAllocator* allocators[] = {nullptr, &copying};
+    const char* names[] = {"resize x2 (default allocator)", "resize x2 (copying allocator)"};
+
+    for (int k = 0; k < 2; k++) {
+        GenArena<Item> arena(allocators[k]);
+        arena.resize(count);
+        for (uint32_t i = 0; i < count; i++) {
+            arena.emplace(i);
+        }
+        char name[128];
+        snprintf(name, sizeof(name), "%s, %u MB", names[k], (unsigned) (count * sizeof(Item) >> 20));
+        // Reported per resize, not per item
+        bench(name, 1, [&]() { arena.resize(2 * count); });
+        g_sink = arena.capacity();
+    }
+}
+
+// Random get() into a big arena, with and without transparent huge pages
+static void bench_huge_pages(uint32_t count) {
+    for (int huge = 0; huge < 2; huge++) {
+        GenArena<Item> arena;
+        GenArenaMemoryOptions options = {};
+        options.huge_pages = huge != 0;
+        arena.set_memory_options(options);
+        arena.resize(count);
+
+        std::vector<GenArena<Item>::Ref> refs(count);
+        for (uint32_t i = 0; i < count; i++) {
+            refs[i] = arena.emplace(i).first;
+        }
+        std::shuffle(refs.begin(), refs.end(), std::mt19937(1234));
+
+        char name[128];
+        snprintf(name, sizeof(name), "get (random, %u MB, %s)", (unsigned) (count * sizeof(Item) >> 20),
+                 huge ? "huge pages" : "4 KB pages");
+        bench(name, count, [&]() {
+            uint64_t sum = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                sum += arena.get(refs[i])->a;
+            }
+            g_sink = sum;
+        });
+    }
+}
+
+// Walking a shuffled list of refs into a big arena with some work per item (like refs held by other objects),
+// with a get() per ref and with get_pipelined(). With little work per item, the out-of-order window of the CPU already overlaps
+// the misses of independent get() calls, so the pipeline pays off as the work per item grows.
+static void bench_get_pipelined(uint32_t count) {
+    GenArena<Item> arena;
+    arena.resize(count);
+    std::vector<GenArena<Item>::Ref> refs(count);
+    for (uint32_t i = 0; i < count; i++) {
+        refs[i] = arena.emplace(i).first;
+    }
+    std::shuffle(refs.begin(), refs.end(), std::mt19937(1234));
+
+    // A chain of dependent multiplications, standing in for the work done per item
+    auto work = [](uint64_t x) {
+        for (int k = 0; k < 32; k++) x = x * 6364136223846793005ull + 1442695040888963407ull;
+        return x;
+    };
+
+    bench("get + work (random)", count, [&]() {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            sum += work(arena.get(refs[i])->a);
+        }
+        g_sink = sum;
+    });
+
+    bench("try_get + work (random)", count, [&]() {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            sum += work(arena.try_get(refs[i])->a);
+        }
+        g_sink = sum;
+    });
+
+    bench("get_pipelined + work (random)", count, [&]() {
+        uint64_t sum = 0;
+        arena.get_pipelined(refs.data(), count, [&](GenArena<Item>::Ref, Item& item) { sum += work(item.a); });
+        g_sink = sum;
+    });
+}
+
+// A cache of 1/8 of the keys under a skewed access pattern (lookups that miss insert the item again)
+static void bench_cache(uint32_t key_count, uint32_t ops) {
+    GenArenaCache<Item> cache(key_count / 8);
+    std::vector<GenArenaCache<Item>::Ref> refs(key_count);
+
+    // Products of two uniform numbers, so that small keys are much hotter than big ones
+    std::vector<uint32_t> keys(ops);
+    std::mt19937 rng(1234);
+    for (uint32_t i = 0; i < ops; i++) {
+        keys[i] = (uint32_t) ((uint64_t) (rng() % key_count) * (rng() % key_count) / key_count);
+    }
+
+    uint32_t hits = 0;
+    bench("cache lookup or insert", ops, [&]() {
+        for (uint32_t i = 0; i < ops; i++) {
+            uint32_t key = keys[i];
+            if (cache.try_get(refs[key]) != nullptr) {
+                hits++;
+            } else {
+                refs[key] = cache.emplace(key).first;
+            }
+        }
+    });
+    printf("%-48s %8.2f %%\n", "cache hit rate", 100.0 * hits / ops);
+}
+
+int main() {
+    const uint32_t count = 1 << 20;
+
+    print_header();
+
+    printf("== Configs ==\n");
+    bench_config<GenArenaConfig<32, 8, 24>>("<32, 8, 24>", count);
+    bench_config<GenArenaConfig<32, 0, 32>>("<32, 0, 32>", count);
+    bench_config<GenArenaConfig<20, 0, 12>>("<20, 0, 12>", count / 2);
+    bench_config<GenArenaConfig<32, 8, 24, 4>>("<32, 8, 24, 4 groups>", count);
+
+
+    printf("== Reuse policies ==\n");
+    bench_reuse_policies(count / 2, count * 2);
+
+
+    printf("== Secondary maps ==\n");
+    bench_secondary_maps(count / 2);
+
+
+    printf("== Joins ==\n");
+    bench_join(count);
+
+
+    printf("== Allocators ==\n");
+    bench_small_arenas(16384, 16);
+    bench_growth(count * 4);
+
+
+    printf("== Lookups ==\n");
+    bench_get_pipelined(count * 8);
+
+
+    printf("== Caches ==\n");
+    bench_cache(count / 4, count * 4);
+
+
+    printf("== Memory placement ==\n");
+    bench_huge_pages(count * 16);
+
+    return 0;
+}
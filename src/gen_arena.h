@@ -4,6 +4,40 @@
 
 #include <gen_arena_raw.h>
 
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define GEN_ARENA_HAS_PMR
+#endif
+#endif
+
+#ifdef GEN_ARENA_HAS_PMR
+// Makes an allocator that forwards to a std::pmr::memory_resource (which should outlive the arenas using it). For example:
+//   std::pmr::monotonic_buffer_resource level_memory;
+//   GenArenaAllocator allocator = gen_arena_pmr_allocator(&level_memory);
+//   GenArena<Enemy> enemies(&allocator);
+inline GenArenaAllocator gen_arena_pmr_allocator(std::pmr::memory_resource* resource) {
+    GenArenaAllocator allocator;
+    allocator.allocate = [](void* ctx, size_t size, size_t alignment) -> void* {
+        // Unlike gen_arena_aligned_alloc(), memory resources report failures with exceptions
+#ifdef __cpp_exceptions
+        try {
+            return static_cast<std::pmr::memory_resource*>(ctx)->allocate(size, alignment);
+        } catch (...) {
+            return nullptr;
+        }
+#else
+        return static_cast<std::pmr::memory_resource*>(ctx)->allocate(size, alignment);
+#endif
+    };
+    allocator.deallocate = [](void* ctx, void* ptr, size_t size, size_t alignment) {
+        static_cast<std::pmr::memory_resource*>(ctx)->deallocate(ptr, size, alignment);
+    };
+    allocator.ctx = resource;
+    return allocator;
+}
+#endif
+
 #ifdef GEN_ARENA_FORCE_DECLARE_TYPE_ID_FUN
 template <class T>
 constexpr uint32_t gen_arena_type_id();
@@ -14,8 +48,25 @@ constexpr uint32_t gen_arena_type_id() { return 0; }
 
 #endif
 
+// Resolves to gen_arena_type_id<T>() only if the Config actually stores type ids
+// (so that GEN_ARENA_FORCE_DECLARE_TYPE_ID_FUN doesn't require declarations for configs without them).
+template <class T, bool has_type_id>
+struct GenArenaTypeIdOf {
+    static constexpr uint32_t value = gen_arena_type_id<T>();
+};
+
+template <class T>
+struct GenArenaTypeIdOf<T, false> {
+    static constexpr uint32_t value = 0;
+};
+
 template <class T, class Config = GenArenaDefaultConfig>
 class GenArenaTypedRef : public GenArenaRef<Config> {
+public:
+    GenArenaTypedRef() = default;
+
+    // Untyped refs (for example from a GenHandleAllocator) need to be converted explicitly.
+    explicit GenArenaTypedRef(GenArenaRef<Config> ref) : GenArenaRef<Config>(ref) {}
 };
 
 template <class T, class Config = GenArenaDefaultConfig>
@@ -26,6 +77,8 @@ private:
 public:
     using Ref = GenArenaTypedRef<T, Config>;
 
+    static constexpr uint32_t TYPE_ID = GenArenaTypeIdOf<T, (Config::TypeIdBits > 0)>::value;
+
     friend void swap(GenArena& a1, GenArena& a2) {
         using std::swap;
 
@@ -38,6 +91,12 @@ public:
         (void) res;
     }
 
+    // Uses the given allocator for all buffers of the arena (see GenArenaAllocator).
+    explicit GenArena(const GenArenaAllocator* allocator) noexcept {
+        GenArenaResult res = setup(0, allocator);
+        (void) res;
+    }
+
     ~GenArena() noexcept {
         // release() doesn't return any errors, so it's safe to do this in the destructor.
         release();
@@ -58,18 +117,30 @@ public:
         return *this;
     }
 
-    GenArenaResult setup(uint32_t capacity) {
-        return _raw.setup(capacity, sizeof(T), alignof(T), gen_arena_type_id<T>());
+    GenArenaResult setup(uint32_t capacity, const GenArenaAllocator* allocator = nullptr) {
+        return _raw.setup(capacity, sizeof(T), alignof(T), TYPE_ID, allocator);
     }
 
     GenArenaResult resize(uint32_t new_capacity) {
         return _raw.resize(new_capacity);
     }
 
+    GenArenaResult reserve_dense(uint32_t capacity) {
+        return _raw.reserve_dense(capacity);
+    }
+
+    GenArenaResult reserve_sparse(uint32_t slot_count) {
+        return _raw.reserve_sparse(slot_count);
+    }
+
     GenArenaResult shrink() {
         return _raw.shrink();
     }
 
+    void trim() {
+        _raw.trim();
+    }
+
     void release() {
         _raw.release();
     }
@@ -78,6 +149,33 @@ public:
 
     uint32_t capacity() const { return _raw.capacity(); }
 
+    const GenArenaAllocator* allocator() const { return _raw.allocator(); }
+
+    GenArenaStats stats() const { return _raw.stats(); }
+
+    void reset_stats() { _raw.reset_stats(); }
+
+    GenArenaMemoryReport memory_report() const { return _raw.memory_report(); }
+
+    // Names the arena in the memory registry (see GEN_ARENA_ENABLE_MEMORY_REGISTRY).
+    void set_name(const char* name) { _raw.set_name(name); }
+
+    const GenArenaMemoryOptions& memory_options() const { return _raw.memory_options(); }
+
+    void set_memory_options(const GenArenaMemoryOptions& options) { _raw.set_memory_options(options); }
+
+    const GenArenaGrowthPolicy& growth_policy() const { return _raw.growth_policy(); }
+
+    void set_growth_policy(const GenArenaGrowthPolicy& policy) { _raw.set_growth_policy(policy); }
+
+    const GenArenaReusePolicy& reuse_policy() const { return _raw.reuse_policy(); }
+
+    void set_reuse_policy(const GenArenaReusePolicy& policy) { _raw.set_reuse_policy(policy); }
+
+    const GenArenaRaw<Config>& raw() const { return _raw; }
+
+    GenArenaRaw<Config>& raw() { return _raw; }
+
     const T* item_buf() const { return static_cast<const T*>(_raw.item_buf()); }
 
     T* item_buf() { return static_cast<T*>(_raw.item_buf()); }
@@ -97,9 +195,7 @@ public:
             else {
                 gen_arena_log("GenArena error in insert(T&&): unknown");
             }
-            ref.index = 0;
-            ref.type_id = gen_arena_type_id<T>();
-            ref.generation = 0;
+            ref.set(0, TYPE_ID, 0);
             ptr = nullptr;
         }
         if (out_ptr) *out_ptr = ptr;
@@ -120,9 +216,7 @@ public:
             else {
                 gen_arena_log("GenArena error in insert(T&&): unknown");
             }
-            ref.index = 0;
-            ref.type_id = gen_arena_type_id<T>();
-            ref.generation = 0;
+            ref.set(0, TYPE_ID, 0);
             ptr = nullptr;
         }
         if (out_ptr) *out_ptr = ptr;
@@ -143,9 +237,7 @@ public:
             } else {
                 gen_arena_log("GenArena error in insert(T&&): unknown");
             }
-            ref.index = 0;
-            ref.type_id = gen_arena_type_id<T>();
-            ref.generation = 0;
+            ref.set(0, TYPE_ID, 0);
             ptr = nullptr;
         }
         return {ref, static_cast<T*>(ptr)};
@@ -164,9 +256,7 @@ public:
             } else {
                 gen_arena_log("GenArena error in insert(T&&): unknown");
             }
-            ref.index = 0;
-            ref.type_id = gen_arena_type_id<T>();
-            ref.generation = 0;
+            ref.set(0, TYPE_ID, 0);
             ptr = nullptr;
         }
         return {ref, static_cast<T*>(ptr)};
@@ -188,14 +278,34 @@ public:
             } else {
                 gen_arena_log("GenArena error in emplace(...): unknown");
             }
-            ref.index = 0;
-            ref.type_id = gen_arena_type_id<T>();
-            ref.generation = 0;
+            ref.set(0, TYPE_ID, 0);
             ptr = nullptr;
         }
         return {ref, static_cast<T*>(ptr)};
     }
 
+    // Inserts an item under an externally allocated ref (see GenArenaRaw::insert_empty_at()).
+    // Returns nullptr on failure (for example if there already is an item for the ref).
+    template <class... Args>
+    T* emplace_at(GenArenaRef<Config> ref, Args&& ... args) {
+        void* ptr;
+        GenArenaResult res = _raw.insert_empty_at(ref, ptr);
+        if (res == GenArenaResult::Ok) {
+            return new(ptr) T(std::forward<Args>(args)...);
+        } else {
+            if (res == GenArenaResult::OutOfMemory) {
+                gen_arena_log("GenArena error in emplace_at(...): out of memory! (size = %d, capacity = %d)", size(),
+                              capacity());
+            } else if (res == GenArenaResult::RefInvalid) {
+                gen_arena_log("GenArena error in emplace_at(...): ref invalid! (index = %d, generation = %d)",
+                              (uint32_t) ref.index(), (uint32_t) ref.generation());
+            } else {
+                gen_arena_log("GenArena error in emplace_at(...): unknown");
+            }
+            return nullptr;
+        }
+    }
+
     void release(Ref ref) {
         // Release with the destructor using a custom deleter lambda
         GenArenaResult res = _raw.release_with_deleter(ref, [](void* ptr) {
@@ -205,13 +315,20 @@ public:
         if (res != GenArenaResult::Ok) {
             if (res == GenArenaResult::RefInvalid) {
                 gen_arena_log("GenArena error in release(Ref): ref invalid! (index = %d, generation = %d)",
-                              (uint32_t) ref.index, (uint32_t) ref.generation);
+                              (uint32_t) ref.index(), (uint32_t) ref.generation());
             } else {
                 gen_arena_log("GenArena error in release(Ref): unknown");
             }
         }
     }
 
+    // Releases the items of all valid refs in the array, skipping invalid ones. Returns the number of released items.
+    uint32_t release_batch(const Ref* refs, uint32_t count) {
+        return _raw.release_batch_with_deleter(refs, count, [](void* ptr) {
+            static_cast<T*>(ptr)->~T();
+        });
+    }
+
     bool is_valid_ref(Ref ref) const {
         return _raw.is_valid_ref(ref);
     }
@@ -232,26 +349,71 @@ public:
         return static_cast<T*>(_raw.try_get(ref));
     }
 
+    // Prefetches the sparse entry of the ref, for a get() of it a bit later.
+    void prefetch(Ref ref) const {
+        _raw.prefetch(ref);
+    }
+
+    // Calls fun(Ref, T&) for each valid ref in the array, skipping invalid ones, and returns the number of visited items.
+    // This is a software-pipelined loop (see GenArenaRaw::get_pipelined()), which is much faster than calling try_get() for
+    // each ref when the refs point all over a big arena and fun does some work per item.
+    template <class Fun>
+    uint32_t get_pipelined(const Ref* refs, uint32_t count, Fun&& fun) {
+        return _raw.get_pipelined(refs, count, [&](Ref ref, void* ptr) {
+            fun(ref, *static_cast<T*>(ptr));
+        });
+    }
+
+    template <class Fun>
+    uint32_t get_pipelined(const Ref* refs, uint32_t count, Fun&& fun) const {
+        return _raw.get_pipelined(refs, count, [&](Ref ref, void* ptr) {
+            fun(ref, *static_cast<const T*>(ptr));
+        });
+    }
+
     uint32_t get_item_idx(Ref ref) const {
         return _raw.get_item_idx(ref);
     }
 
+    static constexpr uint32_t group_count() { return Config::GroupCount; }
+
+    uint32_t group_size(uint32_t group) const { return _raw.group_size(group); }
+
+    uint32_t get_group(Ref ref) const { return _raw.get_group(ref); }
+
+    void set_group(Ref ref, uint32_t group) {
+        GenArenaResult res = _raw.set_group(ref, group);
+
+        if (res != GenArenaResult::Ok) {
+            if (res == GenArenaResult::RefInvalid) {
+                gen_arena_log("GenArena error in set_group(Ref, uint32_t): ref invalid! (index = %d, generation = %d)",
+                              (uint32_t) ref.index(), (uint32_t) ref.generation());
+            } else if (res == GenArenaResult::GroupInvalid) {
+                gen_arena_log("GenArena error in set_group(Ref, uint32_t): group invalid! (group = %d)", group);
+            } else {
+                gen_arena_log("GenArena error in set_group(Ref, uint32_t): unknown");
+            }
+        }
+    }
+
     template <class Fun>
     void foreach_ref(Fun&& fun) {
+        GEN_ARENA_TRACE_SCOPE("GenArena::foreach_ref");
         GenArenaMetadata* metadata = _raw.metadata_buf();
-        auto* free_list = _raw.free_list_buf();
+        const GenArenaFreeList<Config>& free_list = _raw.free_list();
+        // (The raw arena's type id, which comes from the refs of emplace_at() if the arena shares a handle space)
+        uint32_t tid = _raw.type_id();
         for (uint32_t i = 0; i < _raw.size(); i++) {
             uint32_t index = metadata[i].dense_to_sparse;
             Ref ref;
-            ref.index = index;
-            ref.type_id = gen_arena_type_id<T>();
-            ref.generation = free_list[index].generation;
+            ref.set(index, tid, free_list.generation(index));
             fun(ref);
         }
     }
 
     template <class Fun>
     void foreach_val(Fun&& fun) {
+        GEN_ARENA_TRACE_SCOPE("GenArena::foreach_val");
         T* items = static_cast<T*>(_raw.item_buf());
         for (uint32_t i = 0; i < _raw.size(); i++) {
             auto& val = items[i];
@@ -261,15 +423,46 @@ public:
 
     template <class Fun>
     void foreach_ref_val(Fun&& fun) {
+        GEN_ARENA_TRACE_SCOPE("GenArena::foreach_ref_val");
         T* items = static_cast<T*>(_raw.item_buf());
         GenArenaMetadata* metadata = _raw.metadata_buf();
-        auto* free_list = _raw.free_list_buf();
+        const GenArenaFreeList<Config>& free_list = _raw.free_list();
+        uint32_t tid = _raw.type_id();
         for (uint32_t i = 0; i < _raw.size(); i++) {
             uint32_t index = metadata[i].dense_to_sparse;
             Ref ref;
-            ref.index = index;
-            ref.type_id = gen_arena_type_id<T>();
-            ref.generation = free_list[index].generation;
+            ref.set(index, tid, free_list.generation(index));
+            auto& val = items[i];
+            fun(ref, val);
+        }
+    }
+
+    // Items of a group are contiguous in the dense buffer, so these are tight loops without any branching.
+    template <class Fun>
+    void foreach_in_group(uint32_t group, Fun&& fun) {
+        GEN_ARENA_TRACE_SCOPE("GenArena::foreach_in_group");
+        gen_arena_assert(group < Config::GroupCount);
+        T* items = static_cast<T*>(_raw.item_buf());
+        uint32_t end = _raw.group_end(group);
+        for (uint32_t i = _raw.group_begin(group); i < end; i++) {
+            auto& val = items[i];
+            fun(val);
+        }
+    }
+
+    template <class Fun>
+    void foreach_ref_val_in_group(uint32_t group, Fun&& fun) {
+        GEN_ARENA_TRACE_SCOPE("GenArena::foreach_ref_val_in_group");
+        gen_arena_assert(group < Config::GroupCount);
+        T* items = static_cast<T*>(_raw.item_buf());
+        GenArenaMetadata* metadata = _raw.metadata_buf();
+        const GenArenaFreeList<Config>& free_list = _raw.free_list();
+        uint32_t tid = _raw.type_id();
+        uint32_t end = _raw.group_end(group);
+        for (uint32_t i = _raw.group_begin(group); i < end; i++) {
+            uint32_t index = metadata[i].dense_to_sparse;
+            Ref ref;
+            ref.set(index, tid, free_list.generation(index));
             auto& val = items[i];
             fun(ref, val);
         }
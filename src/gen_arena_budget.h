@@ -0,0 +1,119 @@
+#pragma once
+
+/**
+ * A process-wide cap on the bytes of all arena buffers (see GEN_ARENA_ENABLE_BUDGET in gen_arena_config.h).
+ * Every growth of an arena buffer (items, metadata and free list) acquires its extra bytes from the budget first,
+ * and the arena returns GenArenaResult::OutOfMemory if they don't fit under the cap. Shrinking and freeing always succeed.
+ *
+ * Before failing, the registered pressure callbacks are called one by one with the number of bytes that are missing,
+ * and the growth is retried after each of them. A callback should make room by shrinking or releasing arenas that are idle,
+ * but never the arena that is growing (the callbacks run inside its resize), nor grow arenas itself (growth fails meanwhile).
+ * Note that trim() doesn't make room, since the budget counts the reserved bytes (capacity) and trim() keeps the capacity.
+ *
+ * Buffers are counted by their capacity. A buffer that is grown by copying (instead of with mremap(), see GEN_ARENA_USE_MREMAP)
+ * only counts its new size, even though both copies live for a moment.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class GenArenaBudget {
+public:
+    using PressureCallback = void (*)(void* ctx, size_t bytes_needed);
+
+private:
+    struct Callback {
+        PressureCallback fun;
+        void* ctx;
+    };
+
+    std::atomic<size_t> _used;
+    std::atomic<size_t> _cap;
+
+    std::mutex _mutex;
+    std::vector<Callback> _callbacks;
+
+    GenArenaBudget() : _used(0), _cap(SIZE_MAX) {}
+
+    bool try_add(size_t bytes) {
+        size_t cap = _cap.load(std::memory_order_relaxed);
+        size_t used = _used.load(std::memory_order_relaxed);
+        do {
+            if (used > cap || bytes > cap - used) return false;
+        } while (!_used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+        return true;
+    }
+
+public:
+    static GenArenaBudget& instance() {
+        static GenArenaBudget budget;
+        return budget;
+    }
+
+    GenArenaBudget(const GenArenaBudget& other) = delete;
+
+    GenArenaBudget& operator=(const GenArenaBudget& other) = delete;
+
+    // Bytes of all arena buffers
+    size_t used() const { return _used.load(std::memory_order_relaxed); }
+
+    size_t cap() const { return _cap.load(std::memory_order_relaxed); }
+
+    // Lowering the cap below used() doesn't free anything, it only makes the next growths fail (or call the pressure callbacks).
+    void set_cap(size_t cap) { _cap.store(cap, std::memory_order_relaxed); }
+
+    void add_pressure_callback(PressureCallback fun, void* ctx) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _callbacks.push_back(Callback{fun, ctx});
+    }
+
+    void remove_pressure_callback(PressureCallback fun, void* ctx) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _callbacks.size(); i++) {
+            if (_callbacks[i].fun == fun && _callbacks[i].ctx == ctx) {
+                _callbacks.erase(_callbacks.begin() + i);
+                return;
+            }
+        }
+    }
+
+    // Returns false if the bytes don't fit under the cap, even after calling the pressure callbacks.
+    bool acquire(size_t bytes) {
+        if (try_add(bytes)) return true;
+
+        // Growths from within the callbacks just fail, instead of calling the callbacks again
+        static thread_local bool in_callbacks = false;
+        if (!in_callbacks) {
+            std::vector<Callback> callbacks;
+            {
+                // Copy them, so that the callbacks can add or remove callbacks
+                std::lock_guard<std::mutex> lock(_mutex);
+                callbacks = _callbacks;
+            }
+            in_callbacks = true;
+            bool ok = false;
+            for (const Callback& callback : callbacks) {
+                size_t available = cap() > used() ? cap() - used() : 0;
+                callback.fun(callback.ctx, bytes > available ? bytes - available : 0);
+                if (try_add(bytes)) {
+                    ok = true;
+                    break;
+                }
+            }
+            in_callbacks = false;
+            if (ok) return true;
+        }
+
+        gen_arena_log("GenArenaBudget error in acquire(...): over the cap! (bytes = %llu, used = %llu, cap = %llu)",
+                      (unsigned long long) bytes, (unsigned long long) used(), (unsigned long long) cap());
+        return false;
+    }
+
+    void release(size_t bytes) {
+        _used.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+/**
+ * A generational arena used as a cache with a budget, which evicts items with the CLOCK algorithm (an approximation of LRU).
+ * Each item has a cost (1 by default, so the budget is an item count, but it can also be the size in bytes of the item),
+ * and inserting evicts items until the total cost fits in the budget again.
+ *
+ * Refs of evicted items are stale, so lookups of them read as misses. A hit only sets the item's "referenced" bit
+ * (a plain store, instead of splicing a list like LRU). The clock hand sweeps the dense buffer: referenced items get their bit cleared,
+ * and the first unreferenced item is evicted. Since the dense buffer is already packed, the hand doesn't need any links.
+ */
+
+#include <gen_arena.h>
+
+template <class T, class Config = GenArenaDefaultConfig>
+class GenArenaCache {
+public:
+    using Ref = GenArenaTypedRef<T, Config>;
+
+    // Called with each evicted item right before it's destroyed (not for items that are released or cleared explicitly).
+    using EvictionCallback = void (*)(void* ctx, Ref ref, T& value);
+
+    static constexpr uint32_t TYPE_ID = GenArenaTypeIdOf<T, (Config::TypeIdBits > 0)>::value;
+
+    static_assert(Config::GroupCount == 1, "GenArenaCache doesn't support group partitions");
+
+private:
+    struct Entry {
+        T value;
+        uint64_t cost;
+        bool referenced;
+
+        template <class... Args>
+        explicit Entry(uint64_t cost, Args&& ... args) : value(std::forward<Args>(args)...), cost(cost), referenced(true) {}
+    };
+
+    GenArenaRaw<Config> _raw;
+
+    uint64_t _budget;
+    uint64_t _total_cost;
+    uint32_t _hand;
+
+    EvictionCallback _on_evict;
+    void* _on_evict_ctx;
+
+    Entry* entries() { return static_cast<Entry*>(_raw.item_buf()); }
+
+    Ref make_ref(uint32_t dense_index) const {
+        uint32_t slot = _raw.metadata_buf()[dense_index].dense_to_sparse;
+        Ref ref;
+        ref.set(slot, TYPE_ID, _raw.free_list().generation(slot));
+        return ref;
+    }
+
+    void release_entry(Ref ref) {
+        Entry* entry = static_cast<Entry*>(_raw.get(ref));
+        _total_cost -= entry->cost;
+        GenArenaResult res = _raw.release_with_deleter(ref, [](void* ptr) {
+            static_cast<Entry*>(ptr)->~Entry();
+        });
+        (void) res;
+    }
+
+    // Evicts one item with the clock hand. The cache shouldn't be empty.
+    void evict_one() {
+        Entry* items = entries();
+        for (;;) {
+            if (_hand >= _raw.size()) _hand = 0;
+            if (!items[_hand].referenced) break;
+            items[_hand].referenced = false;
+            _hand++;
+        }
+        // The hand stays in place, since releasing moves the last item into the hole
+        Ref ref = make_ref(_hand);
+        if (_on_evict != nullptr) _on_evict(_on_evict_ctx, ref, items[_hand].value);
+        release_entry(ref);
+    }
+
+public:
+    explicit GenArenaCache(uint64_t budget = 0) noexcept
+            : _budget(budget), _total_cost(0), _hand(0), _on_evict(nullptr), _on_evict_ctx(nullptr) {
+        // setup() with zero capacity guarantees it will succeed without any errors.
+        GenArenaResult res = _raw.setup(0, sizeof(Entry), alignof(Entry), TYPE_ID);
+        (void) res;
+    }
+
+    ~GenArenaCache() noexcept {
+        clear();
+        _raw.release();
+    }
+
+    GenArenaCache(const GenArenaCache& other) = delete;
+
+    GenArenaCache& operator=(const GenArenaCache& other) = delete;
+
+    uint32_t size() const { return _raw.size(); }
+
+    uint64_t budget() const { return _budget; }
+
+    uint64_t total_cost() const { return _total_cost; }
+
+    // Evicts items right away if the new budget is smaller than the total cost.
+    void set_budget(uint64_t budget) {
+        _budget = budget;
+        while (_total_cost > _budget) evict_one();
+    }
+
+    void set_eviction_callback(EvictionCallback fun, void* ctx) {
+        _on_evict = fun;
+        _on_evict_ctx = ctx;
+    }
+
+    // Inserts an item with the given cost, evicting other items to make room for it.
+    // Returns a nullptr item (and an invalid ref) if the cost is over the whole budget, or if out of memory.
+    template <class... Args>
+    std::pair<Ref, T*> emplace_with_cost(uint64_t cost, Args&& ... args) {
+        Ref ref;
+        ref.set(0, TYPE_ID, 0);
+        if (cost > _budget) {
+            gen_arena_log("GenArenaCache error in emplace(...): cost is over the budget! (cost = %llu, budget = %llu)",
+                          (unsigned long long) cost, (unsigned long long) _budget);
+            return {ref, nullptr};
+        }
+        while (_total_cost + cost > _budget) evict_one();
+
+        void* ptr;
+        GenArenaResult res = _raw.insert_empty(ptr, ref);
+        if (res != GenArenaResult::Ok) {
+            gen_arena_log("GenArenaCache error in emplace(...): out of memory! (size = %d, capacity = %d)",
+                          _raw.size(), _raw.capacity());
+            ref.set(0, TYPE_ID, 0);
+            return {ref, nullptr};
+        }
+        _total_cost += cost;
+        Entry* entry = new(ptr) Entry(cost, std::forward<Args>(args)...);
+        return {ref, &entry->value};
+    }
+
+    template <class... Args>
+    std::pair<Ref, T*> emplace(Args&& ... args) {
+        return emplace_with_cost(1, std::forward<Args>(args)...);
+    }
+
+    // Returns nullptr on a miss (the item was evicted or released), and marks the item as recently used on a hit.
+    T* try_get(Ref ref) {
+        Entry* entry = static_cast<Entry*>(_raw.try_get(ref));
+        if (entry == nullptr) return nullptr;
+        entry->referenced = true;
+        return &entry->value;
+    }
+
+    // Same as try_get(), but doesn't count as a use.
+    const T* peek(Ref ref) const {
+        const Entry* entry = static_cast<const Entry*>(_raw.try_get(ref));
+        return entry == nullptr ? nullptr : &entry->value;
+    }
+
+    bool contains(Ref ref) const {
+        return _raw.is_valid_ref(ref);
+    }
+
+    bool release(Ref ref) {
+        if (!_raw.is_valid_ref(ref)) {
+            gen_arena_log("GenArenaCache error in release(Ref): ref invalid! (index = %d, generation = %d)",
+                          (uint32_t) ref.index(), (uint32_t) ref.generation());
+            return false;
+        }
+        release_entry(ref);
+        return true;
+    }
+
+    void clear() {
+        while (_raw.size() > 0) {
+            release_entry(make_ref(_raw.size() - 1));
+        }
+        _hand = 0;
+    }
+
+    template <class Fun>
+    void foreach_ref_val(Fun&& fun) {
+        Entry* items = entries();
+        for (uint32_t i = 0; i < _raw.size(); i++) {
+            fun(make_ref(i), items[i].value);
+        }
+    }
+};
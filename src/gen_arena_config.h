@@ -31,6 +31,119 @@ inline void gen_arena_aligned_free(void* ptr) {
 #endif
 #endif
 
+/* Page mapping functions, used for big buffers on Linux so that they can be grown with mremap().
+ * Growing a mapping only remaps its page tables instead of copying the contents (and the kernel can often grow it in place),
+ * so resizing a huge arena takes microseconds instead of copying gigabytes.
+ * Only buffers of at least GEN_ARENA_MREMAP_THRESHOLD bytes are mapped, since every mapping takes at least one page (and a syscall).
+ * This is disabled when using custom alloc functions (GEN_ARENA_CUSTOM_ALLOC), or by defining GEN_ARENA_DISABLE_MREMAP. */
+
+#if defined(__linux__) && !defined(GEN_ARENA_CUSTOM_ALLOC) && !defined(GEN_ARENA_DISABLE_MREMAP)
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef MREMAP_MAYMOVE // Needs _GNU_SOURCE (which g++ and clang++ define by default)
+#define GEN_ARENA_USE_MREMAP
+
+#ifndef GEN_ARENA_MREMAP_THRESHOLD
+#define GEN_ARENA_MREMAP_THRESHOLD (1u << 20)
+#endif
+
+// The alignment should be a multiple of the page size (it's used to align buffers to huge pages).
+inline void* gen_arena_pages_alloc(size_t size, size_t alignment) {
+    if (alignment < (size_t) getpagesize()) alignment = getpagesize();
+
+    // Over-map by the alignment, and unmap the unaligned head and tail
+    size_t padded_size = size + alignment - getpagesize();
+    void* ptr = mmap(nullptr, padded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return nullptr;
+
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t aligned_begin = (begin + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    uintptr_t end = begin + padded_size;
+    uintptr_t aligned_end = (aligned_begin + size + getpagesize() - 1) & ~(uintptr_t) (getpagesize() - 1);
+    if (aligned_begin != begin) munmap(ptr, aligned_begin - begin);
+    if (aligned_end < end) munmap(reinterpret_cast<void*>(aligned_end), end - aligned_end);
+    return reinterpret_cast<void*>(aligned_begin);
+}
+
+// On failure, returns nullptr and leaves the old mapping untouched.
+inline void* gen_arena_pages_realloc(void* ptr, size_t old_size, size_t new_size) {
+    void* new_ptr = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+    return new_ptr == MAP_FAILED ? nullptr : new_ptr;
+}
+
+inline void gen_arena_pages_free(void* ptr, size_t size) {
+    munmap(ptr, size);
+}
+
+// Returns the (page-aligned) pages to the OS while keeping them mapped. They read as zeroes when touched again.
+inline void gen_arena_pages_discard(void* ptr, size_t size) {
+    madvise(ptr, size, MADV_DONTNEED);
+}
+
+inline size_t gen_arena_page_size() {
+    return (size_t) getpagesize();
+}
+
+// Asks the kernel to back the pages with transparent huge pages (so that random accesses into huge buffers miss the TLB less).
+inline void gen_arena_pages_use_huge(void* ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, size, MADV_HUGEPAGE);
+#else
+    (void) ptr;
+    (void) size;
+#endif
+}
+
+// Sets the NUMA memory policy of the pages (mode is MPOL_BIND = 2 or MPOL_INTERLEAVE = 3 from <numaif.h>),
+// which applies to the pages faulted in afterwards. Calls the syscall directly, so that we don't need to link libnuma.
+// Returns false if it failed (for example on kernels without NUMA support), in which case the pages just use the default policy.
+inline bool gen_arena_pages_set_numa_policy(void* ptr, size_t size, int mode, const unsigned long* nodemask, unsigned long maxnode) {
+#ifdef SYS_mbind
+    return syscall(SYS_mbind, ptr, size, mode, nodemask, maxnode, 0) == 0;
+#else
+    (void) ptr;
+    (void) size;
+    (void) mode;
+    (void) nodemask;
+    (void) maxnode;
+    return false;
+#endif
+}
+
+// Sets the bits of the online NUMA nodes (read from sysfs) in the mask of mask_bits bits.
+// Returns the highest online node plus one, or 0 if the online nodes couldn't be read.
+inline unsigned long gen_arena_numa_online_nodes(unsigned long* nodemask, unsigned long mask_bits) {
+    FILE* file = fopen("/sys/devices/system/node/online", "r");
+    if (file == nullptr) return 0;
+    char line[1024];
+    bool ok = fgets(line, sizeof(line), file) != nullptr;
+    fclose(file);
+    if (!ok) return 0;
+
+    // A list of ranges, like "0-3,8,10-11"
+    const unsigned long BITS = 8 * sizeof(unsigned long);
+    unsigned long node_count = 0;
+    char* pos = line;
+    while (*pos >= '0' && *pos <= '9') {
+        unsigned long first = strtoul(pos, &pos, 10);
+        unsigned long last = first;
+        if (*pos == '-') last = strtoul(pos + 1, &pos, 10);
+        if (last >= mask_bits || first > last) return 0;
+        for (unsigned long node = first; node <= last; node++) {
+            nodemask[node / BITS] |= 1ul << (node % BITS);
+        }
+        node_count = last + 1;
+        if (*pos == ',') pos++;
+    }
+    return node_count;
+}
+
+#endif
+#endif
+
 /* Assert functions. The default implementation uses C's default one, but you might want to swap this out. */
 
 #ifndef GEN_ARENA_CUSTOM_ASSERT
@@ -63,6 +176,43 @@ inline int gen_arena_clz(uint32_t value) { // GCC and Clang has this nice builti
 #endif
 #endif
 
+/* The ctz (count-trailing-zeroes) function for 64-bit values, used to iterate over bitmaps.
+ * The value is guaranteed to be non-zero. */
+
+#ifndef GEN_ARENA_CUSTOM_CTZ
+#if defined(_WIN32) && defined(_MSC_VER) && !defined(__clang__) // If Windows MSVC (not Clang)...
+#include <intrin.h>
+inline int gen_arena_ctz64(uint64_t value) {
+    unsigned long trailing_zero = 0;
+    _BitScanForward64(&trailing_zero, value);
+    return (int) trailing_zero;
+}
+#else
+
+inline int gen_arena_ctz64(uint64_t value) {
+    return __builtin_ctzll(value);
+}
+
+#endif
+#endif
+
+/* The prefetch function, which hints the CPU to load the cache line of the given address (for reading). */
+
+#ifndef GEN_ARENA_CUSTOM_PREFETCH
+#if defined(_WIN32) && defined(_MSC_VER) && !defined(__clang__) // If Windows MSVC (not Clang)...
+#include <xmmintrin.h>
+inline void gen_arena_prefetch(const void* addr) {
+    _mm_prefetch(static_cast<const char*>(addr), _MM_HINT_T0);
+}
+#else
+
+inline void gen_arena_prefetch(const void* addr) {
+    __builtin_prefetch(addr);
+}
+
+#endif
+#endif
+
 /* The logging function.
  * The default implementation prints out logs to stdout, but you probably might not want this behavior.
  * Feel free to swap this out with whatever log system you are using for your application or library. */
@@ -94,10 +244,61 @@ void gen_arena_log(const char* fmt, Args&&... args) {
 
 // #define GEN_ARENA_DONT_RETURN_REF_PTR_PAIR
 
-/* TODO */
+/* Determines if the type id stored in each ref should be validated.
+ * If enabled, refs whose type id doesn't match the arena's are treated as invalid refs
+ * (is_valid_ref() and try_get() fail, release() returns RefInvalid, and get() asserts).
+ * This is useful when untyped refs are passed around, for example with GenArenaRegistry. */
 
 // #define GEN_ARENA_USE_TYPE_ID
 
+/* Number of slots per page of the sparse arrays (see GenArenaFreeList). Should be a power of two.
+ * Smaller pages can be freed more often by trim(), but make the page table bigger. */
+
+#ifndef GEN_ARENA_SPARSE_PAGE_SIZE
+#define GEN_ARENA_SPARSE_PAGE_SIZE 4096
+#endif
+
+/* Determines if arenas count their operations (inserts, releases, resizes, invalid ref lookups, ...), which can be read with GenArenaRaw::stats().
+ * The counters are sharded per thread (so threads rarely update the same cache line), so they're cheap, but not free:
+ * each arena also gets GEN_ARENA_STATS_SHARDS cache lines of counters (512 bytes by default). When disabled, stats() only reports the sizes. */
+
+// #define GEN_ARENA_ENABLE_STATS
+
+/* Trace hooks around the operations that can stall or take long (resize, shrink, trim, batch operations and foreach loops).
+ * GEN_ARENA_TRACE_SCOPE(name) should trace the rest of the enclosing scope as a span with the given name (a string literal).
+ * By default it expands to nothing, so tracing costs nothing when it's off.
+ * Define GEN_ARENA_ENABLE_TRACE to use the built-in backend (per-thread ring buffers exported as Chrome trace JSON, see gen_arena_trace.h),
+ * or define GEN_ARENA_TRACE_SCOPE yourself to forward the spans to your own profiler. */
+
+// #define GEN_ARENA_ENABLE_TRACE
+
+#if defined(GEN_ARENA_ENABLE_TRACE)
+#include "gen_arena_trace.h"
+#define GEN_ARENA_TRACE_SCOPE(name) GenArenaTraceScope gen_arena_trace_scope(name)
+#elif !defined(GEN_ARENA_TRACE_SCOPE)
+#define GEN_ARENA_TRACE_SCOPE(name)
+#endif
+
+/* Determines if arenas add themselves to a process-wide registry (in setup(), and remove themselves in release()),
+ * so that the memory footprint of all arenas can be dumped at once with gen_arena_memory_registry_dump() (see gen_arena_stats.h).
+ * This costs a mutex lock in setup() and release(), and pulls in <mutex> and <unordered_map>. */
+
+// #define GEN_ARENA_ENABLE_MEMORY_REGISTRY
+
+#ifdef GEN_ARENA_ENABLE_MEMORY_REGISTRY
+#include "gen_arena_memory_registry.h"
+#endif
+
+/* Determines if all growths of arena buffers go through a process-wide byte budget (GenArenaBudget::instance(), see gen_arena_budget.h).
+ * Growths that don't fit under its cap (unlimited by default) call the pressure callbacks, and fail with GenArenaResult::OutOfMemory if still over it.
+ * This costs an atomic compare-and-swap per buffer growth or free. */
+
+// #define GEN_ARENA_ENABLE_BUDGET
+
+#ifdef GEN_ARENA_ENABLE_BUDGET
+#include "gen_arena_budget.h"
+#endif
+
 /* Determines if we will force users to declare the constexpr type-id function gen_arena_type_id<T>().
  * If you are using type-id information, then it might be best to force users to declare this function (or else a compiler error will occur)
  * But if you are not using this feature, then the fallback implementation (which just returns zero) will work fine. */
@@ -0,0 +1,199 @@
+#pragma once
+
+/**
+ * A generational arena with a fixed capacity of N items, stored inline (so it never allocates).
+ * Inserts fail fast (returning a nullptr item) when the arena is full, instead of resizing.
+ * Since N is known at compile time, the internal index types are the smallest that can hold N,
+ * so for example a GenArenaFixed<T, 200> only needs 1 byte per item for its metadata.
+ *
+ * Refs are the same as the refs of GenArena<T, Config>, so they can be stored in the same places.
+ * Note that C++11 constexpr functions can't construct items in place, so only the static parts (capacity(), ...) are constexpr.
+ *
+ * Unlike GenArena, slots aren't retired when their generation runs out: it wraps around from GENERATION_MASK to 1
+ * (0 is never used, so the invalid ref returned by a failed emplace never matches a live item).
+ * So a stale ref to a slot can become valid again after the slot is reused GENERATION_MASK times.
+ */
+
+#include <gen_arena.h>
+
+template <class T, uint32_t N, class Config = GenArenaDefaultConfig>
+class GenArenaFixed {
+public:
+    using Ref = GenArenaTypedRef<T, Config>;
+
+    static constexpr uint32_t TYPE_ID = GenArenaTypeIdOf<T, (Config::TypeIdBits > 0)>::value;
+
+    static_assert(N > 0, "GenArenaFixed needs a capacity of at least one");
+    static_assert(N < GenArenaRef<Config>::INDEX_MASK, "The capacity of GenArenaFixed doesn't fit in the index bits of the Config");
+
+private:
+    // Index type for both slots and dense indices, with N as the free list terminator
+    using Index = typename GenArenaUint<N>::Type;
+    using Generation = typename GenArenaUint<GenArenaRef<Config>::GENERATION_MASK>::Type;
+
+    static constexpr Index NIL = N;
+
+    struct Node {
+        Index index; // Index to the dense buffer if used, or to the next free slot if free
+        Generation generation;
+    };
+
+    alignas(T) unsigned char _items[N][sizeof(T)];
+    Index _dense_to_sparse[N];
+    Node _nodes[N];
+
+    Index _item_size;
+    Index _node_size;
+
+    Index _front;
+    Index _back;
+
+    T* item_at(uint32_t dense_index) { return reinterpret_cast<T*>(_items[dense_index]); }
+
+    const T* item_at(uint32_t dense_index) const { return reinterpret_cast<const T*>(_items[dense_index]); }
+
+    Ref make_ref(uint32_t slot) const {
+        Ref ref;
+        ref.set(slot, TYPE_ID, _nodes[slot].generation);
+        return ref;
+    }
+
+public:
+    GenArenaFixed() noexcept : _item_size(0), _node_size(0), _front(NIL), _back(NIL) {}
+
+    ~GenArenaFixed() noexcept {
+        clear();
+    }
+
+    // Refs point into the inline storage, so these can't be copied or moved.
+    GenArenaFixed(const GenArenaFixed& other) = delete;
+
+    GenArenaFixed& operator=(const GenArenaFixed& other) = delete;
+
+    static constexpr uint32_t capacity() { return N; }
+
+    uint32_t size() const { return _item_size; }
+
+    bool empty() const { return _item_size == 0; }
+
+    bool full() const { return _item_size == N; }
+
+    const T* item_buf() const { return item_at(0); }
+
+    T* item_buf() { return item_at(0); }
+
+    // Releases all items (which invalidates all refs to them).
+    void clear() {
+        while (_item_size > 0) {
+            release(make_ref(_dense_to_sparse[_item_size - 1]));
+        }
+    }
+
+    // Returns a nullptr item (and an invalid ref) if the arena is full.
+    template <class... Args>
+    std::pair<Ref, T*> emplace(Args&& ... args) {
+        if (_item_size == N) {
+            gen_arena_log("GenArenaFixed error in emplace(...): arena is full! (capacity = %d)", N);
+            Ref ref;
+            ref.set(0, TYPE_ID, 0);
+            return {ref, nullptr};
+        }
+
+        // Take a slot from the front of the free list, or append a new one
+        // (note that the number of used slots can't exceed the number of items, so this always succeeds)
+        uint32_t slot;
+        if (_front == NIL) {
+            slot = _node_size++;
+            _nodes[slot].generation = 1;
+        } else {
+            slot = _front;
+            _front = _nodes[slot].index;
+            if (_front == NIL) _back = NIL;
+        }
+
+        uint32_t dense_index = _item_size++;
+        _nodes[slot].index = (Index) dense_index;
+        _dense_to_sparse[dense_index] = (Index) slot;
+        T* ptr = new(_items[dense_index]) T(std::forward<Args>(args)...);
+        return {make_ref(slot), ptr};
+    }
+
+    std::pair<Ref, T*> insert(const T& value) { return emplace(value); }
+
+    std::pair<Ref, T*> insert(T&& value) { return emplace(std::move(value)); }
+
+    bool release(Ref ref) {
+        if (!is_valid_ref(ref)) {
+            gen_arena_log("GenArenaFixed error in release(Ref): ref invalid! (index = %d, generation = %d)",
+                          (uint32_t) ref.index(), (uint32_t) ref.generation());
+            return false;
+        }
+
+        uint32_t slot = ref.index();
+        uint32_t dense_index = _nodes[slot].index;
+
+        // Remove-swap the last item into the hole
+        uint32_t last = _item_size - 1;
+        item_at(dense_index)->~T();
+        if (dense_index != last) {
+            new(_items[dense_index]) T(std::move(*item_at(last)));
+            item_at(last)->~T();
+            _dense_to_sparse[dense_index] = _dense_to_sparse[last];
+            _nodes[_dense_to_sparse[dense_index]].index = (Index) dense_index;
+        }
+        _item_size--;
+
+        // Invalidate the refs to the slot (skipping generation 0 when wrapping around), and append it to the back of the free list
+        Node& node = _nodes[slot];
+        node.index = NIL;
+        node.generation = node.generation == GenArenaRef<Config>::GENERATION_MASK ? 1 : (Generation) (node.generation + 1);
+        if (_front == NIL) {
+            _front = _back = (Index) slot;
+        } else {
+            _nodes[_back].index = (Index) slot;
+            _back = (Index) slot;
+        }
+        return true;
+    }
+
+    bool is_valid_ref(Ref ref) const {
+        if (ref.index() >= _node_size) return false;
+#ifdef GEN_ARENA_USE_TYPE_ID
+        if (ref.type_id() != TYPE_ID) return false;
+#endif
+        const Node& node = _nodes[ref.index()];
+        return node.index < _item_size && node.generation == ref.generation();
+    }
+
+    const T* get(Ref ref) const {
+        gen_arena_assert(is_valid_ref(ref));
+        return item_at(_nodes[ref.index()].index);
+    }
+
+    T* get(Ref ref) {
+        gen_arena_assert(is_valid_ref(ref));
+        return item_at(_nodes[ref.index()].index);
+    }
+
+    const T* try_get(Ref ref) const {
+        return is_valid_ref(ref) ? item_at(_nodes[ref.index()].index) : nullptr;
+    }
+
+    T* try_get(Ref ref) {
+        return is_valid_ref(ref) ? item_at(_nodes[ref.index()].index) : nullptr;
+    }
+
+    template <class Fun>
+    void foreach_val(Fun&& fun) {
+        for (uint32_t i = 0; i < _item_size; i++) {
+            fun(*item_at(i));
+        }
+    }
+
+    template <class Fun>
+    void foreach_ref_val(Fun&& fun) {
+        for (uint32_t i = 0; i < _item_size; i++) {
+            fun(make_ref(_dense_to_sparse[i]), *item_at(i));
+        }
+    }
+};
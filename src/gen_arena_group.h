@@ -0,0 +1,134 @@
+#pragma once
+
+/**
+ * An owning group over several arenas that share one index space (see GenArenaRaw::insert_empty_at()).
+ * The group keeps the items whose refs exist in all member arenas packed at the front of each dense buffer, in the same order.
+ * So the i-th item of every member (for i < size()) belongs to the same ref,
+ * and iterating the group is a set of lockstep sequential loops over the item buffers, without any probing.
+ *
+ * The invariant is kept with O(1) swaps per member, but only if all inserts and releases of the members go through the group
+ * (or at least notify it with on_insert() after inserting, and on_release() before releasing).
+ * Members can't use group partitions (Config::GroupCount should be 1), and an arena can only be owned by one group.
+ */
+
+#include <gen_arena.h>
+
+template <class Config, uint32_t N>
+class GenArenaOwningGroup {
+public:
+    using Ref = GenArenaRef<Config>;
+
+    static_assert(N > 0, "GenArenaOwningGroup needs at least one member");
+    static_assert(Config::GroupCount == 1, "Members of a GenArenaOwningGroup can't use group partitions");
+
+private:
+    GenArenaRaw<Config>* _members[N];
+    uint32_t _size;
+
+    bool in_all_members(Ref ref) const {
+        for (uint32_t k = 0; k < N; k++) {
+            if (!_members[k]->is_valid_ref(ref)) return false;
+        }
+        return true;
+    }
+
+public:
+    template <class... Raws>
+    explicit GenArenaOwningGroup(Raws* ... members) : _members{members...}, _size(0) {
+        static_assert(sizeof...(Raws) == N, "Wrong number of members for GenArenaOwningGroup");
+        rebuild();
+    }
+
+    // Number of items owned by the group (which are at the front of each member's dense buffer)
+    uint32_t size() const { return _size; }
+
+    GenArenaRaw<Config>& member(uint32_t k) { return *_members[k]; }
+
+    bool contains(Ref ref) const {
+        return in_all_members(ref) && _members[0]->get_item_idx(ref) < _size;
+    }
+
+    // Collects the refs that are already in all members into the group.
+    void rebuild() {
+        _size = 0;
+        uint32_t smallest = 0;
+        for (uint32_t k = 1; k < N; k++) {
+            if (_members[k]->size() < _members[smallest]->size()) smallest = k;
+        }
+        // Note that on_insert() only swaps items at positions >= _size, so the items that we haven't visited yet stay behind i.
+        const GenArenaRaw<Config>& driver = *_members[smallest];
+        for (uint32_t i = 0; i < driver.size(); i++) {
+            uint32_t slot = driver.metadata_buf()[i].dense_to_sparse;
+            on_insert(Ref::make(slot, driver.type_id(), driver.free_list().generation(slot)));
+        }
+    }
+
+    // Should be called after an item for the ref is inserted into one of the members.
+    void on_insert(Ref ref) {
+        if (!in_all_members(ref)) return;
+        if (_members[0]->get_item_idx(ref) < _size) return; // already in the group
+
+        for (uint32_t k = 0; k < N; k++) {
+            _members[k]->swap_items(_members[k]->get_item_idx(ref), _size);
+        }
+        _size++;
+    }
+
+    // Should be called before an item of the ref is released from one of the members.
+    // This moves the ref out of the group (to the position right after it), so that the release doesn't break the packed range.
+    void on_release(Ref ref) {
+        if (!contains(ref)) return;
+
+        _size--;
+        for (uint32_t k = 0; k < N; k++) {
+            _members[k]->swap_items(_members[k]->get_item_idx(ref), _size);
+        }
+    }
+
+    template <class T, class... Args>
+    T* emplace_at(GenArena<T, Config>& arena, Ref ref, Args&& ... args) {
+        T* ptr = arena.emplace_at(ref, std::forward<Args>(args)...);
+        if (ptr != nullptr) {
+            on_insert(ref);
+            // The item might have been moved by the group
+            ptr = arena.get(typename GenArena<T, Config>::Ref(ref));
+        }
+        return ptr;
+    }
+
+    template <class T>
+    void release(GenArena<T, Config>& arena, Ref ref) {
+        on_release(ref);
+        arena.release(typename GenArena<T, Config>::Ref(ref));
+    }
+
+    // Calls fun(T1&, T2&, ...) for each ref owned by the group. The arenas should be given in the same order as the members.
+    template <class Fun, class... Ts>
+    void foreach_val(Fun&& fun, GenArena<Ts, Config>& ... arenas) {
+        GEN_ARENA_TRACE_SCOPE("GenArenaOwningGroup::foreach_val");
+        static_assert(sizeof...(Ts) == N, "foreach_val() should be given all members of the group");
+        for (uint32_t i = 0; i < _size; i++) {
+            fun(arenas.item_buf()[i]...);
+        }
+    }
+
+    // Calls fun(Ref, T1&, T2&, ...) for each ref owned by the group.
+    template <class Fun, class... Ts>
+    void foreach_ref_val(Fun&& fun, GenArena<Ts, Config>& ... arenas) {
+        GEN_ARENA_TRACE_SCOPE("GenArenaOwningGroup::foreach_ref_val");
+        static_assert(sizeof...(Ts) == N, "foreach_ref_val() should be given all members of the group");
+        const GenArenaMetadata* metadata = _members[0]->metadata_buf();
+        const GenArenaFreeList<Config>& free_list = _members[0]->free_list();
+        uint32_t tid = _members[0]->type_id();
+        for (uint32_t i = 0; i < _size; i++) {
+            uint32_t slot = metadata[i].dense_to_sparse;
+            fun(Ref::make(slot, tid, free_list.generation(slot)), arenas.item_buf()[i]...);
+        }
+    }
+};
+
+// Helper for creating an owning group over typed arenas (since C++11 can't deduce the class template arguments)
+template <class Config, class... Ts>
+GenArenaOwningGroup<Config, sizeof...(Ts)> gen_arena_make_owning_group(GenArena<Ts, Config>& ... arenas) {
+    return GenArenaOwningGroup<Config, sizeof...(Ts)>(&arenas.raw()...);
+}
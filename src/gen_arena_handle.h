@@ -0,0 +1,179 @@
+#pragma once
+
+/**
+ * A generational handle allocator (a generational arena without any item storage).
+ * This is intended for subsystems that only need generational ids, and keep their data somewhere else (like external SoA buffers).
+ * It's built from the same free list as GenArenaRaw, plus a bitmap of live handles for iteration.
+ * Like GenArenaRaw, it doesn't depend on the STL.
+ */
+
+#include "gen_arena_raw.h"
+
+template <class Config = GenArenaDefaultConfig>
+class GenHandleAllocator {
+public:
+    using Ref = GenArenaRef<Config>;
+
+private:
+    GenArenaFreeList<Config> _free_list;
+
+    // One bit per slot of the free list, set if the slot is currently allocated.
+    // Allocated like the pages of the free list (with its allocator and memory options).
+    uint64_t* _live_bits;
+    uint32_t _live_words;
+    uint32_t _live_count;
+
+    uint32_t _tid;
+
+    GenArenaResult reserve_bits(uint32_t slot_count) {
+        uint32_t words = (slot_count + 63) / 64;
+        if (words <= _live_words) return GenArenaResult::Ok;
+        if (words < 2 * _live_words) words = 2 * _live_words;
+
+        size_t old_bytes = sizeof(uint64_t) * _live_words;
+        void* new_ptr = gen_arena_buffer_realloc(_free_list.allocator(), _free_list.memory_options(), _live_bits,
+                                                 old_bytes, sizeof(uint64_t) * words, old_bytes, alignof(uint64_t));
+        if (new_ptr == nullptr) return GenArenaResult::OutOfMemory;
+        uint64_t* new_bits = static_cast<uint64_t*>(new_ptr);
+        memset(new_bits + _live_words, 0, sizeof(uint64_t) * (words - _live_words));
+
+        _live_bits = new_bits;
+        _live_words = words;
+        return GenArenaResult::Ok;
+    }
+
+    bool is_live(uint32_t slot) const {
+        return (_live_bits[slot / 64] >> (slot % 64)) & 1;
+    }
+
+    // Assumes that the bitmap already covers the slots of the free list.
+    Ref allocate_unchecked(uint32_t slot) {
+        _live_bits[slot / 64] |= uint64_t(1) << (slot % 64);
+        _live_count++;
+        _free_list.set_index(slot, slot);
+        return Ref::make(slot, _tid, _free_list.generation(slot));
+    }
+
+public:
+    // Uses the given allocator for all of its buffers (or gen_arena_default_allocator() if nullptr).
+    GenArenaResult setup(uint32_t initial_capacity, uint32_t tid = 0, const GenArenaAllocator* allocator = nullptr) {
+        _live_bits = nullptr;
+        _live_words = 0;
+        _live_count = 0;
+        _tid = tid & Ref::TYPE_ID_MASK;
+
+        GenArenaResult res = _free_list.setup(initial_capacity, allocator != nullptr ? allocator : gen_arena_default_allocator());
+        if (res != GenArenaResult::Ok) return res;
+        return reserve_bits(initial_capacity);
+    }
+
+    void release() {
+        gen_arena_buffer_free(_free_list.allocator(), _live_bits, sizeof(uint64_t) * _live_words, alignof(uint64_t));
+        _free_list.release();
+        _live_bits = nullptr;
+        _live_words = 0;
+        _live_count = 0;
+    }
+
+    // Number of live handles
+    uint32_t size() const { return _live_count; }
+
+    uint32_t capacity() const { return _free_list.capacity(); }
+
+    // Number of slots ever handed out (live, free and retired)
+    uint32_t free_list_size() const { return _free_list.size(); }
+
+    // Number of slots that were retired since their generation saturated (see GenArenaFreeList::push())
+    uint32_t retired_count() const { return _free_list.retired_count(); }
+
+    uint32_t type_id() const { return _tid; }
+
+    // Bitmap of the live handles (bit i of word i / 64 is set if slot i is live), covering free_list_size() slots.
+    const uint64_t* live_bits() const { return _live_bits; }
+
+    GenArenaResult reserve(uint32_t new_capacity) {
+        GenArenaResult res = _free_list.reserve(new_capacity);
+        if (res != GenArenaResult::Ok) return res;
+        return reserve_bits(new_capacity);
+    }
+
+    GenArenaResult allocate(Ref& ref) {
+        uint32_t slot;
+        GenArenaResult res = _free_list.acquire(slot);
+        if (res != GenArenaResult::Ok) return res;
+
+        res = reserve_bits(_free_list.size());
+        if (res != GenArenaResult::Ok) {
+            _free_list.push(slot);
+            return res;
+        }
+
+        ref = allocate_unchecked(slot);
+        return GenArenaResult::Ok;
+    }
+
+    // Allocates count handles at once. Either all of them are allocated, or none of them (on OutOfMemory).
+    GenArenaResult allocate_batch(Ref* out_refs, uint32_t count) {
+        GEN_ARENA_TRACE_SCOPE("GenHandleAllocator::allocate_batch");
+        uint32_t free_count = _free_list.size() - _live_count - _free_list.retired_count();
+        if (count > free_count) {
+            uint32_t needed = _free_list.size() + (count - free_count);
+            if (needed < _free_list.size() || needed > GenArenaFreeList<Config>::NIL) return GenArenaResult::OutOfMemory;
+            GenArenaResult res = reserve(needed);
+            if (res != GenArenaResult::Ok) return res;
+        }
+
+        // Since the capacity is reserved, acquiring slots can't fail anymore
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t slot;
+            GenArenaResult res = _free_list.acquire(slot);
+            (void) res;
+            out_refs[i] = allocate_unchecked(slot);
+        }
+        return GenArenaResult::Ok;
+    }
+
+    GenArenaResult free(Ref ref) {
+        if (!is_valid_ref(ref)) return GenArenaResult::RefInvalid;
+
+        uint32_t slot = ref.index();
+        _live_bits[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        _live_count--;
+        _free_list.push(slot);
+        return GenArenaResult::Ok;
+    }
+
+    // Frees all valid refs in the batch. Returns RefInvalid if any of the refs were invalid (those are skipped).
+    GenArenaResult free_batch(const Ref* refs, uint32_t count) {
+        GEN_ARENA_TRACE_SCOPE("GenHandleAllocator::free_batch");
+        GenArenaResult res = GenArenaResult::Ok;
+        for (uint32_t i = 0; i < count; i++) {
+            if (free(refs[i]) != GenArenaResult::Ok) res = GenArenaResult::RefInvalid;
+        }
+        return res;
+    }
+
+    bool is_valid_ref(Ref ref) const {
+        uint32_t slot = ref.index();
+        if (slot >= _free_list.size()) return false;
+#ifdef GEN_ARENA_USE_TYPE_ID
+        if (ref.type_id() != _tid) return false;
+#endif
+        return is_live(slot) && _free_list.generation(slot) == ref.generation();
+    }
+
+    // Calls fun(Ref) for each live handle, in increasing order of index.
+    template <class Fun>
+    void foreach_live(Fun&& fun) const {
+        GEN_ARENA_TRACE_SCOPE("GenHandleAllocator::foreach_live");
+        uint32_t words = (_free_list.size() + 63) / 64;
+        for (uint32_t w = 0; w < words; w++) {
+            uint64_t bits = _live_bits[w];
+            while (bits != 0) {
+                uint32_t slot = w * 64 + gen_arena_ctz64(bits);
+                bits &= bits - 1;
+                fun(Ref::make(slot, _tid, _free_list.generation(slot)));
+            }
+        }
+    }
+};
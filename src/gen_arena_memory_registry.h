@@ -0,0 +1,67 @@
+#pragma once
+
+/**
+ * A process-wide list of all live arenas (see GEN_ARENA_ENABLE_MEMORY_REGISTRY in gen_arena_config.h),
+ * so that the memory footprint of every arena can be dumped at once (for example when a memory pressure alert fires).
+ * Arenas are added by GenArenaRaw::setup() and removed by GenArenaRaw::release(). All functions are thread-safe.
+ * See gen_arena_memory_registry_dump() in gen_arena_stats.h for a text dump.
+ */
+
+#include <mutex>
+#include <unordered_map>
+
+struct GenArenaMemoryReport;
+
+class GenArenaMemoryRegistry {
+public:
+    // Type-erased GenArenaRaw<Config>::memory_report()
+    using ReportFun = void (*)(const void* arena, GenArenaMemoryReport& report);
+
+    struct Entry {
+        const char* name; // nullptr if the arena wasn't named
+        ReportFun report;
+    };
+
+private:
+    std::mutex _mutex;
+    std::unordered_map<const void*, Entry> _arenas;
+
+public:
+    static GenArenaMemoryRegistry& instance() {
+        static GenArenaMemoryRegistry registry;
+        return registry;
+    }
+
+    // Adds the arena (or keeps it if it's already there, along with its name).
+    void add(const void* arena, ReportFun report) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Entry entry = {nullptr, report};
+        _arenas.insert({arena, entry});
+    }
+
+    void remove(const void* arena) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _arenas.erase(arena);
+    }
+
+    void set_name(const void* arena, const char* name) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _arenas.find(arena);
+        if (it != _arenas.end()) it->second.name = name;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _arenas.size();
+    }
+
+    // Calls fun(arena, entry) for each live arena. The registry is locked meanwhile,
+    // so fun shouldn't set up or release arenas (but it can call entry.report(arena, report)).
+    template <class Fun>
+    void foreach(Fun&& fun) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& pair : _arenas) {
+            fun(pair.first, pair.second);
+        }
+    }
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+/**
+ * Join iteration over several arenas that share one index space
+ * (arenas whose items are inserted with emplace_at() under refs from the same GenHandleAllocator).
+ *
+ * gen_arena_join(fun, positions, velocities) calls fun(ref, Position&, Velocity&) for every ref that has an item in all arenas.
+ * Iteration is driven by the dense array of the smallest arena, and the sparse arrays of the other arenas are probed in batches:
+ * the sparse nodes of the next batch are prefetched, and the current batch is validated in two passes: the indices and generations
+ * of the batch are gathered from the sparse pages first, and then compared in a branch-free loop over plain arrays
+ * (which compilers can vectorize, unlike the gathers, which go through the page table).
+ * The arenas must not be modified during the join.
+ */
+
+#include <gen_arena.h>
+
+// Number of refs that are probed together in gen_arena_join()
+#ifndef GEN_ARENA_JOIN_BATCH_SIZE
+#define GEN_ARENA_JOIN_BATCH_SIZE 32
+#endif
+
+// Minimal C++11 version of std::index_sequence
+template <uint32_t... Is>
+struct GenArenaIndexSequence {
+};
+
+template <uint32_t N, uint32_t... Is>
+struct GenArenaMakeIndexSequence : GenArenaMakeIndexSequence<N - 1, N - 1, Is...> {
+};
+
+template <uint32_t... Is>
+struct GenArenaMakeIndexSequence<0, Is...> {
+    using Type = GenArenaIndexSequence<Is...>;
+};
+
+template <class Config, class Fun, class... Ts, uint32_t... Is>
+void gen_arena_join_impl(Fun& fun, GenArenaIndexSequence<Is...>, GenArena<Ts, Config>& ... arenas) {
+    GEN_ARENA_TRACE_SCOPE("gen_arena_join");
+    using Ref = GenArenaRef<Config>;
+    constexpr uint32_t N = sizeof...(Ts);
+    constexpr uint32_t BATCH = GEN_ARENA_JOIN_BATCH_SIZE;
+
+    const GenArenaRaw<Config>* raws[N] = {&arenas.raw()...};
+    void* items[N] = {arenas.raw().item_buf()...};
+
+    // Drive the iteration from the arena with the least items
+    uint32_t driver = 0;
+    for (uint32_t k = 1; k < N; k++) {
+        if (raws[k]->size() < raws[driver]->size()) driver = k;
+    }
+    const GenArenaMetadata* driver_metadata = raws[driver]->metadata_buf();
+    const GenArenaFreeList<Config>& driver_free_list = raws[driver]->free_list();
+    uint32_t driver_size = raws[driver]->size();
+    uint32_t tid = raws[driver]->type_id();
+
+    // If the smallest arena isn't empty, then none of them are (so none of the sparse arrays probed below are null)
+    if (driver_size == 0) return;
+
+    const GenArenaFreeList<Config>* free_lists[N];
+    uint32_t node_counts[N];
+    uint32_t sizes[N];
+    for (uint32_t k = 0; k < N; k++) {
+        free_lists[k] = &raws[k]->free_list();
+        node_counts[k] = raws[k]->free_list_size();
+        sizes[k] = raws[k]->size();
+    }
+
+    uint32_t slots[BATCH];
+    uint32_t generations[BATCH];
+    uint32_t dense[N][BATCH];
+    uint32_t probe_generations[BATCH];
+    uint32_t valid[BATCH];
+
+    for (uint32_t base = 0; base < driver_size; base += BATCH) {
+        uint32_t count = driver_size - base < BATCH ? driver_size - base : BATCH;
+
+        // Gather the refs of this batch from the driver
+        for (uint32_t j = 0; j < count; j++) {
+            slots[j] = driver_metadata[base + j].dense_to_sparse;
+            generations[j] = driver_free_list.generation(slots[j]);
+            dense[driver][j] = base + j;
+            valid[j] = 1;
+        }
+
+        // Prefetch the sparse nodes that the next batch will probe
+        uint32_t next_end = base + 2 * BATCH < driver_size ? base + 2 * BATCH : driver_size;
+        for (uint32_t i = base + BATCH; i < next_end; i++) {
+            uint32_t slot = driver_metadata[i].dense_to_sparse;
+            for (uint32_t k = 0; k < N; k++) {
+                if (k != driver && slot < node_counts[k]) free_lists[k]->prefetch(slot);
+            }
+        }
+
+        // Validate the batch against the other arenas
+        for (uint32_t k = 0; k < N; k++) {
+            if (k == driver) continue;
+            const GenArenaFreeList<Config>& probe_free_list = *free_lists[k];
+            uint32_t probe_count = node_counts[k];
+            uint32_t probe_size = sizes[k];
+            for (uint32_t j = 0; j < count; j++) {
+                uint32_t slot = slots[j] < probe_count ? slots[j] : 0;
+                dense[k][j] = probe_free_list.index(slot);
+                probe_generations[j] = probe_free_list.generation(slot);
+            }
+            for (uint32_t j = 0; j < count; j++) {
+                valid[j] &= (uint32_t) (slots[j] < probe_count) & (uint32_t) (dense[k][j] < probe_size) &
+                            (uint32_t) (probe_generations[j] == generations[j]);
+            }
+        }
+
+        for (uint32_t j = 0; j < count; j++) {
+            if (valid[j]) {
+                fun(Ref::make(slots[j], tid, generations[j]), static_cast<Ts*>(items[Is])[dense[Is][j]]...);
+            }
+        }
+    }
+}
+
+template <class Fun, class Config, class... Ts>
+void gen_arena_join(Fun&& fun, GenArena<Ts, Config>& ... arenas) {
+    static_assert(sizeof...(Ts) > 0, "gen_arena_join() needs at least one arena");
+    gen_arena_join_impl<Config>(fun, typename GenArenaMakeIndexSequence<sizeof...(Ts)>::Type(), arenas...);
+}
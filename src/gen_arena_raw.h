@@ -4,11 +4,17 @@
  * A generational arena.
  * The container isn't templated with the item type (uses void*), 
  * and item type size/alignment can be specified at runtime.
- * Implemented without any dependencies on the STL (only imports <stdint.h>, <stdlib.h>, and optionally <assert.h>)
+ * Implemented without any dependencies on the STL (only imports <stdint.h>, <stdlib.h>, <string.h>, and optionally <assert.h>)
  */
 
+#include <string.h>
+
 #include "gen_arena_config.h"
 
+#ifdef GEN_ARENA_ENABLE_STATS
+#include <atomic>
+#endif
+
 template <class T>
 inline T* gen_arena_new_array(size_t size) {
     return static_cast<T*>(gen_arena_aligned_alloc(sizeof(T) * size, alignof(T)));
@@ -19,13 +25,282 @@ inline void gen_arena_delete_array(T* ptr) {
     gen_arena_aligned_free(ptr);
 }
 
+/* The allocator used for the buffers of an arena, which can be chosen per arena instance (see GenArenaRaw::setup()).
+ * It's a runtime struct of function pointers instead of a template parameter, so arenas with different allocators still have the same type.
+ * ctx is passed to both functions (for stateful allocators, like a per-level monotonic buffer or a per-thread pool),
+ * and deallocate() gets the same size and alignment that were given to allocate() (like std::pmr::memory_resource).
+ * The allocator isn't owned by the arena, so it should outlive the arenas that use it. */
+struct GenArenaAllocator {
+    void* (* allocate)(void* ctx, size_t size, size_t alignment);
+    void (* deallocate)(void* ctx, void* ptr, size_t size, size_t alignment);
+    void* ctx;
+};
+
+inline void* gen_arena_default_allocate(void*, size_t size, size_t alignment) {
+    return gen_arena_aligned_alloc(size, alignment);
+}
+
+inline void gen_arena_default_deallocate(void*, void* ptr, size_t, size_t) {
+    gen_arena_aligned_free(ptr);
+}
+
+// The allocator used when none is given, which uses gen_arena_aligned_alloc() / gen_arena_aligned_free().
+inline const GenArenaAllocator* gen_arena_default_allocator() {
+    static const GenArenaAllocator allocator = {&gen_arena_default_allocate, &gen_arena_default_deallocate, nullptr};
+    return &allocator;
+}
+
+/* Placement options for the buffers of an arena (see GenArenaRaw::set_memory_options()).
+ * These are only hints for the buffers that are mapped pages (see GEN_ARENA_USE_MREMAP), and are ignored everywhere else. */
+
+enum class GenArenaNumaPolicy : uint8_t {
+    Default, // Whatever the thread's policy is (usually the node of the thread that first touches the page)
+    Interleave, // Pages are spread round-robin across all nodes (good for data that every node reads randomly)
+    Bind, // Pages are only allocated on numa_node
+};
+
+struct GenArenaMemoryOptions {
+    // Back the buffers with transparent huge pages (2 MB on x86-64), which cuts TLB misses of random accesses into huge arenas.
+    // Mapped buffers are then also aligned to 2 MB, so that the kernel can actually use huge pages for them.
+    bool huge_pages;
+    GenArenaNumaPolicy numa_policy;
+    uint16_t numa_node;
+};
+
+#ifndef GEN_ARENA_HUGE_PAGE_SIZE
+#define GEN_ARENA_HUGE_PAGE_SIZE (2u << 20)
+#endif
+
+inline void gen_arena_apply_memory_options(void* ptr, size_t size, const GenArenaMemoryOptions& options) {
+#ifdef GEN_ARENA_USE_MREMAP
+    if (options.huge_pages) gen_arena_pages_use_huge(ptr, size);
+
+    if (options.numa_policy != GenArenaNumaPolicy::Default) {
+        const int MPOL_BIND_MODE = 2;
+        const int MPOL_INTERLEAVE_MODE = 3;
+        const unsigned long BITS = 8 * sizeof(unsigned long);
+
+        const unsigned long MASK_BITS = 1024;
+
+        unsigned long nodemask[MASK_BITS / BITS] = {};
+        unsigned long node_count;
+        int mode;
+        if (options.numa_policy == GenArenaNumaPolicy::Bind) {
+            mode = MPOL_BIND_MODE;
+            if (options.numa_node >= MASK_BITS) {
+                gen_arena_log("gen_arena_apply_memory_options: NUMA node %d is out of range, using the default NUMA policy",
+                              (uint32_t) options.numa_node);
+                return;
+            }
+            nodemask[options.numa_node / BITS] = 1ul << (options.numa_node % BITS);
+            node_count = options.numa_node + 1ul;
+        } else {
+            // The kernel rejects masks with nodes that aren't online
+            mode = MPOL_INTERLEAVE_MODE;
+            node_count = gen_arena_numa_online_nodes(nodemask, MASK_BITS);
+            if (node_count == 0) {
+                gen_arena_log("gen_arena_apply_memory_options: couldn't read the online NUMA nodes, using the default NUMA policy");
+                return;
+            }
+        }
+        // mbind() reads maxnode - 1 bits of the mask
+        if (!gen_arena_pages_set_numa_policy(ptr, size, mode, nodemask, node_count + 1)) {
+            gen_arena_log("gen_arena_apply_memory_options: mbind() failed, using the default NUMA policy");
+        }
+    }
+#else
+    (void) ptr;
+    (void) size;
+    (void) options;
+#endif
+}
+
+/* How the buffers of an arena grow when they are full (see GenArenaRaw::set_growth_policy()).
+ * Each growth adds capacity * (factor - 1) items, clamped to [min_step, max_step] (max_step = 0 means no limit).
+ * The default policy doubles, starting from a single item. For huge arenas, a max_step keeps a single growth from reserving gigabytes,
+ * and for small arenas, a min_step skips the many tiny reallocations at the start. */
+struct GenArenaGrowthPolicy {
+    double factor;
+    uint32_t min_step;
+    uint32_t max_step;
+    // Round the byte size of the grown buffer up to whole pages (and use the rest of the last page for more items)
+    bool round_to_pages;
+};
+
+inline GenArenaGrowthPolicy gen_arena_default_growth_policy() {
+    GenArenaGrowthPolicy policy = {2.0, 1, 0, false};
+    return policy;
+}
+
+/* Order in which released slots are reused (see GenArenaRaw::set_reuse_policy()).
+ * Fifo reuses the slot that was released the longest ago. This spreads the releases over all free slots (so generations saturate last),
+ * and keeps a stale ref invalid for as long as possible, but the reused slot's sparse entry is usually cold.
+ * Lifo reuses the slot that was released last, whose sparse entry (and often item) is still in the cache, at the price of ABA safety:
+ * a stale ref to a hot slot only differs from the new ref in the generation.
+ * With Fifo, a quarantine of N keeps the last N released slots from being reused, and new slots are appended while the free list is
+ * that short (so a released slot isn't reused before N other releases, at the price of up to N more sparse entries). */
+enum class GenArenaReuseOrder : uint32_t {
+    Fifo,
+    Lifo,
+};
+
+struct GenArenaReusePolicy {
+    GenArenaReuseOrder order;
+    uint32_t quarantine; // Only used with Fifo
+};
+
+inline GenArenaReusePolicy gen_arena_default_reuse_policy() {
+    GenArenaReusePolicy policy = {GenArenaReuseOrder::Fifo, 0};
+    return policy;
+}
+
+// The capacity that a buffer of item_bytes sized items grows to from `capacity`, so that at least `needed` items fit
+// (but at most max_capacity items, which should be at least `needed`).
+inline uint32_t gen_arena_grow_capacity(const GenArenaGrowthPolicy& policy, uint32_t capacity, uint32_t needed,
+                                        size_t item_bytes, uint32_t max_capacity) {
+    uint64_t grown = (uint64_t) ((double) capacity * policy.factor);
+    uint64_t step = grown > capacity ? grown - capacity : 0;
+    if (step < policy.min_step) step = policy.min_step;
+    if (policy.max_step != 0 && step > policy.max_step) step = policy.max_step;
+    if (step == 0) step = 1;
+
+    uint64_t new_capacity = capacity + step;
+    if (new_capacity < needed) new_capacity = needed;
+
+    if (policy.round_to_pages && item_bytes > 0) {
+#ifdef GEN_ARENA_USE_MREMAP
+        const uint64_t page_size = gen_arena_page_size();
+#else
+        const uint64_t page_size = 4096;
+#endif
+        uint64_t bytes = (new_capacity * item_bytes + page_size - 1) / page_size * page_size;
+        new_capacity = bytes / item_bytes;
+    }
+    return new_capacity > max_capacity ? max_capacity : (uint32_t) new_capacity;
+}
+
+/* Growable buffers of the arenas.
+ * With the default allocator on Linux, big buffers are mapped pages instead (see GEN_ARENA_USE_MREMAP), and grown with mremap().
+ * Whether a buffer is mapped only depends on its size, so callers just need to pass the same sizes for the same buffer. */
+
+inline bool gen_arena_buffer_is_mapped(const GenArenaAllocator* allocator, size_t size, size_t alignment) {
+#ifdef GEN_ARENA_USE_MREMAP
+    // Mappings are page-aligned, which should be enough for everyone
+    return allocator == gen_arena_default_allocator() && size >= GEN_ARENA_MREMAP_THRESHOLD && alignment <= 4096;
+#else
+    (void) allocator;
+    (void) size;
+    (void) alignment;
+    return false;
+#endif
+}
+
+inline void* gen_arena_buffer_alloc(const GenArenaAllocator* allocator, const GenArenaMemoryOptions& options,
+                                    size_t size, size_t alignment) {
+#ifdef GEN_ARENA_USE_MREMAP
+    if (gen_arena_buffer_is_mapped(allocator, size, alignment)) {
+        void* ptr = gen_arena_pages_alloc(size, options.huge_pages ? GEN_ARENA_HUGE_PAGE_SIZE : alignment);
+        if (ptr != nullptr) gen_arena_apply_memory_options(ptr, size, options);
+        return ptr;
+    }
+#else
+    (void) options;
+#endif
+    return allocator->allocate(allocator->ctx, size, alignment);
+}
+
+// Same as gen_arena_buffer_free(), but doesn't return the bytes to the budget (see GEN_ARENA_ENABLE_BUDGET).
+inline void gen_arena_buffer_deallocate(const GenArenaAllocator* allocator, void* ptr, size_t size, size_t alignment) {
+    if (ptr == nullptr) return;
+#ifdef GEN_ARENA_USE_MREMAP
+    if (gen_arena_buffer_is_mapped(allocator, size, alignment)) {
+        gen_arena_pages_free(ptr, size);
+        return;
+    }
+#endif
+    allocator->deallocate(allocator->ctx, ptr, size, alignment);
+}
+
+inline void gen_arena_buffer_free(const GenArenaAllocator* allocator, void* ptr, size_t size, size_t alignment) {
+    if (ptr == nullptr) return;
+#ifdef GEN_ARENA_ENABLE_BUDGET
+    GenArenaBudget::instance().release(size);
+#endif
+    gen_arena_buffer_deallocate(allocator, ptr, size, alignment);
+}
+
+// Returns the whole pages after the first used_size bytes of the buffer to the OS (only for mapped buffers, since this can't be done with malloc).
+inline void gen_arena_buffer_discard_tail(const GenArenaAllocator* allocator, void* ptr, size_t size, size_t used_size,
+                                          size_t alignment) {
+#ifdef GEN_ARENA_USE_MREMAP
+    if (ptr == nullptr || !gen_arena_buffer_is_mapped(allocator, size, alignment)) return;
+    size_t page_size = gen_arena_page_size();
+    size_t begin = (used_size + page_size - 1) & ~(page_size - 1);
+    if (begin < size) gen_arena_pages_discard(static_cast<char*>(ptr) + begin, size - begin);
+#else
+    (void) allocator;
+    (void) ptr;
+    (void) size;
+    (void) used_size;
+    (void) alignment;
+#endif
+}
+
+// If the buffer is grown or shrunk without copying (see gen_arena_buffer_realloc()).
+inline bool gen_arena_buffer_is_remapped(const GenArenaAllocator* allocator, size_t old_size, size_t new_size, size_t alignment) {
+    return old_size > 0 && gen_arena_buffer_is_mapped(allocator, old_size, alignment) &&
+           gen_arena_buffer_is_mapped(allocator, new_size, alignment);
+}
+
+// Same as gen_arena_buffer_realloc(), but doesn't go through the budget (see GEN_ARENA_ENABLE_BUDGET).
+inline void* gen_arena_buffer_move(const GenArenaAllocator* allocator, const GenArenaMemoryOptions& options, void* ptr,
+                                   size_t old_size, size_t new_size, size_t used_size, size_t alignment) {
+#ifdef GEN_ARENA_USE_MREMAP
+    if (ptr != nullptr && gen_arena_buffer_is_mapped(allocator, old_size, alignment) &&
+        gen_arena_buffer_is_mapped(allocator, new_size, alignment)) {
+        void* new_ptr = gen_arena_pages_realloc(ptr, old_size, new_size);
+        // The grown part of the mapping needs the options too
+        if (new_ptr != nullptr) gen_arena_apply_memory_options(new_ptr, new_size, options);
+        return new_ptr;
+    }
+#endif
+    void* new_ptr = gen_arena_buffer_alloc(allocator, options, new_size, alignment);
+    if (new_ptr == nullptr) return nullptr;
+    if (used_size > 0) memcpy(new_ptr, ptr, used_size);
+    gen_arena_buffer_deallocate(allocator, ptr, old_size, alignment);
+    return new_ptr;
+}
+
+// Moves the buffer to one of new_size bytes, keeping the first used_size bytes of its contents.
+// On failure (including going over the budget), returns nullptr and leaves the old buffer untouched.
+inline void* gen_arena_buffer_realloc(const GenArenaAllocator* allocator, const GenArenaMemoryOptions& options, void* ptr,
+                                      size_t old_size, size_t new_size, size_t used_size, size_t alignment) {
+#ifdef GEN_ARENA_ENABLE_BUDGET
+    // Only growth is checked against the cap, so that shrinking always succeeds
+    GenArenaBudget& budget = GenArenaBudget::instance();
+    if (new_size > old_size && !budget.acquire(new_size - old_size)) return nullptr;
+    void* new_ptr = gen_arena_buffer_move(allocator, options, ptr, old_size, new_size, used_size, alignment);
+    if (new_ptr == nullptr) {
+        if (new_size > old_size) budget.release(new_size - old_size);
+    } else if (old_size > new_size) {
+        budget.release(old_size - new_size);
+    }
+    return new_ptr;
+#else
+    return gen_arena_buffer_move(allocator, options, ptr, old_size, new_size, used_size, alignment);
+#endif
+}
+
+// group_count partitions the dense buffer into that many contiguous ranges (see GenArenaRaw::set_group()).
 template <int index_bits,
         int typeid_bits,
-        int generation_bits>
+        int generation_bits,
+        int group_count = 1>
 struct GenArenaConfig {
     static constexpr int IndexBits = index_bits;
     static constexpr int TypeIdBits = typeid_bits;
     static constexpr int GenerationBits = generation_bits;
+    static constexpr int GroupCount = group_count;
 };
 
 using GenArenaDefaultConfig = GenArenaConfig<32, 8, 24>;
@@ -36,6 +311,7 @@ enum class GenArenaResult {
     OutOfVirtualAllocMemory,
     ResizeInvalid,
     RefInvalid,
+    GroupInvalid,
 };
 
 
@@ -43,97 +319,1174 @@ struct GenArenaMetadata {
     uint32_t dense_to_sparse;
 };
 
+constexpr uint32_t gen_arena_bit_mask(int bits) {
+    return bits >= 32 ? 0xffffffffu : (1u << bits) - 1;
+}
+
+template <bool wide>
+struct GenArenaRefStorage {
+    using Type = uint64_t;
+};
+
+template <>
+struct GenArenaRefStorage<false> {
+    using Type = uint32_t;
+};
+
+/**
+ * A generational reference, packed into a single integer without any bitfields.
+ * The layout (from the least significant bit) is [index | type_id | generation].
+ * Configs that fit into 32 bits in total (such as GenArenaConfig<20, 0, 12>) use a uint32_t, otherwise a uint64_t.
+ * This is a trivially copyable type without padding, so it can be used with std::atomic.
+ */
 template <class Config = GenArenaDefaultConfig>
 struct GenArenaRef {
-    uint32_t index: Config::IndexBits;
-    uint32_t type_id: Config::TypeIdBits;
-    uint32_t generation: Config::GenerationBits;
+    static constexpr int TOTAL_BITS = Config::IndexBits + Config::TypeIdBits + Config::GenerationBits;
+
+    static_assert(Config::IndexBits > 0 && Config::IndexBits <= 32, "IndexBits should be in [1, 32]");
+    static_assert(Config::TypeIdBits >= 0 && Config::TypeIdBits <= 32, "TypeIdBits should be in [0, 32]");
+    static_assert(Config::GenerationBits > 0 && Config::GenerationBits <= 32, "GenerationBits should be in [1, 32]");
+    static_assert(TOTAL_BITS <= 64, "A ref should fit in 64 bits");
+
+    using Storage = typename GenArenaRefStorage<(TOTAL_BITS > 32)>::Type;
+
+    static constexpr int TYPE_ID_SHIFT = Config::IndexBits;
+    static constexpr int GENERATION_SHIFT = Config::IndexBits + Config::TypeIdBits;
+
+    static constexpr uint32_t INDEX_MASK = gen_arena_bit_mask(Config::IndexBits);
+    static constexpr uint32_t TYPE_ID_MASK = gen_arena_bit_mask(Config::TypeIdBits);
+    static constexpr uint32_t GENERATION_MASK = gen_arena_bit_mask(Config::GenerationBits);
+
+    Storage value;
+
+    static constexpr Storage pack(uint32_t index, uint32_t type_id, uint32_t generation) {
+        return static_cast<Storage>(index & INDEX_MASK) |
+               (Config::TypeIdBits == 0 ? 0 : static_cast<Storage>(static_cast<Storage>(type_id & TYPE_ID_MASK) << TYPE_ID_SHIFT)) |
+               static_cast<Storage>(static_cast<Storage>(generation & GENERATION_MASK) << GENERATION_SHIFT);
+    }
+
+    static constexpr GenArenaRef make(uint32_t index, uint32_t type_id, uint32_t generation) {
+        return GenArenaRef{pack(index, type_id, generation)};
+    }
+
+    constexpr uint32_t index() const { return static_cast<uint32_t>(value) & INDEX_MASK; }
+
+    constexpr uint32_t type_id() const {
+        return Config::TypeIdBits == 0 ? 0 : static_cast<uint32_t>(value >> TYPE_ID_SHIFT) & TYPE_ID_MASK;
+    }
+
+    constexpr uint32_t generation() const { return static_cast<uint32_t>(value >> GENERATION_SHIFT) & GENERATION_MASK; }
+
+    void set(uint32_t index, uint32_t type_id, uint32_t generation) { value = pack(index, type_id, generation); }
+
+    void set_index(uint32_t index) { value = pack(index, type_id(), generation()); }
+
+    void set_generation(uint32_t generation) { value = pack(index(), type_id(), generation); }
+
+    constexpr bool operator==(const GenArenaRef& other) const { return value == other.value; }
+
+    constexpr bool operator!=(const GenArenaRef& other) const { return value != other.value; }
+};
+
+static_assert(sizeof(GenArenaRef<GenArenaDefaultConfig>) == sizeof(uint64_t), "Unexpected GenArenaRef layout");
+static_assert(sizeof(GenArenaRef<GenArenaConfig<20, 0, 12>>) == sizeof(uint32_t), "Unexpected GenArenaRef layout");
+
+// Smallest unsigned integer type that can hold the values [0, max_value]
+template <uint32_t max_value, bool fits_8 = (max_value <= 0xff), bool fits_16 = (max_value <= 0xffff)>
+struct GenArenaUint {
+    using Type = uint32_t;
+};
+
+template <uint32_t max_value, bool fits_16>
+struct GenArenaUint<max_value, true, fits_16> {
+    using Type = uint8_t;
 };
 
+template <uint32_t max_value>
+struct GenArenaUint<max_value, false, true> {
+    using Type = uint16_t;
+};
+
+/**
+ * The sparse part of a generational arena: the index and the current generation of each slot ever handed out (indexed by ref.index()),
+ * plus a FIFO free list threaded through the indices. While a slot is in use, the owner is free to use its index
+ * (GenArenaRaw stores the dense index of the item there); while it's free, the index links to the next free slot.
+ * This doesn't store any items, so it's also used on its own as a handle allocator (see GenHandleAllocator).
+ *
+ * Indices and generations are kept in separate arrays of the smallest types that fit the Config (the type id bits of a Ref aren't stored),
+ * in pages of GEN_ARENA_SPARSE_PAGE_SIZE slots. The first page grows like a normal buffer (so small arenas stay small),
+ * and after that growing only adds pages, so the existing ones are never copied.
+ * trim() frees the pages whose slots are all free. Their page table entries then point to a shared empty page
+ * (with NIL indices), so lookups don't need to check for them. Freed pages are allocated again once the free list runs out.
+ *
+ * The cost of the pages is one more dependent load per lookup (the page table entry, which is usually cached).
+ * Generations are stored in the smallest unsigned type that fits them, so the 24 generation bits of the default Config
+ * still take 4 bytes (8 bytes per slot with the index).
+ * Full pages are too small to be mapped on their own (see GEN_ARENA_MREMAP_THRESHOLD), so while the memory options
+ * ask for huge pages or a NUMA policy, they are carved out of mapped slabs of GEN_ARENA_HUGE_PAGE_SIZE bytes instead.
+ *
+ * Alternatively, slots can be attached with externally allocated refs (so that several arenas can share one index space).
+ * Such a free list is "external": released slots are only invalidated and never reused by acquire().
+ */
 template <class Config>
-class GenArenaRaw {
+class GenArenaFreeList {
 public:
     using Ref = GenArenaRef<Config>;
+    using Index = typename GenArenaUint<Ref::INDEX_MASK>::Type;
+    using Generation = typename GenArenaUint<Ref::GENERATION_MASK>::Type;
+
+    // Free list terminator, which is the largest index representable by the Ref (so that it survives being stored in one)
+    static constexpr uint32_t NIL = Ref::INDEX_MASK;
+
+    static constexpr uint32_t PAGE_SIZE = GEN_ARENA_SPARSE_PAGE_SIZE;
+
+    static_assert(PAGE_SIZE >= 8 && (PAGE_SIZE & (PAGE_SIZE - 1)) == 0, "GEN_ARENA_SPARSE_PAGE_SIZE should be a power of two (of at least 8)");
 
 private:
-    static constexpr uint32_t NIL = 0xffffffff;
+    // Smallest capacity of the first page, so that the generations (which come after the indices) stay aligned
+    static constexpr uint32_t MIN_PAGE_CAPACITY = 8;
+    static constexpr size_t PAGE_ALIGNMENT = alignof(Index) > alignof(Generation) ? alignof(Index) : alignof(Generation);
+
+    struct Page {
+        Index* indices;
+        Generation* generations; // In the same allocation, right after the indices
+        uint32_t used; // Slots of the page that are in use
+        uint32_t generation_floor; // Generation of the slots of a freed page once it's allocated again
+        bool trimmed; // Set by trim() while it frees the page
+        bool mapped; // Carved out of a mapped slab (see allocate_page())
+    };
+
+    // Page table, covering capacity() slots
+    Page* _pages;
+    uint32_t _page_count;
+    uint32_t _page_table_capacity;
+    uint32_t _freed_page_count;
+    // Only the first page can have less than PAGE_SIZE slots (while it's the only page)
+    uint32_t _first_page_capacity;
+
+    uint32_t _size;
+
+    uint32_t _front;
+    uint32_t _back;
+    uint32_t _length;
+
+    bool _external;
+
+    // Slots whose generation saturated, which are never reused (see push())
+    uint32_t _retired_count;
+
+    // Generation of newly appended slots. This is raised when slots are dropped by trim(),
+    // so that refs to the dropped slots don't become valid again once the slots are appended again.
+    uint32_t _generation_floor;
+
+    const GenArenaAllocator* _allocator;
+    GenArenaMemoryOptions _memory_options;
+    GenArenaGrowthPolicy _growth_policy;
+    GenArenaReusePolicy _reuse_policy;
+
+#ifdef GEN_ARENA_USE_MREMAP
+    // Rest of the current slab of mapped pages
+    char* _slab;
+    size_t _slab_size;
+#endif
+
+    // Arrays shared by the page table entries of all freed pages (which are never written to)
+    static Index* empty_indices() {
+        struct EmptyIndices {
+            Index indices[PAGE_SIZE];
+
+            EmptyIndices() {
+                for (uint32_t i = 0; i < PAGE_SIZE; i++) indices[i] = (Index) NIL;
+            }
+        };
+        static EmptyIndices empty;
+        return empty.indices;
+    }
+
+    static Generation* empty_generations() {
+        static Generation empty[PAGE_SIZE] = {};
+        return empty;
+    }
+
+    static size_t page_bytes(uint32_t capacity) { return (sizeof(Index) + sizeof(Generation)) * capacity; }
+
+    uint32_t page_capacity(uint32_t page) const { return page == 0 ? _first_page_capacity : PAGE_SIZE; }
+
+    bool is_freed(uint32_t page) const { return _pages[page].indices == empty_indices(); }
+
+#ifdef GEN_ARENA_USE_MREMAP
+    // Bytes that a mapped page takes in its slab (whole OS pages, so that it can be unmapped on its own)
+    static size_t mapped_page_stride() {
+        size_t os_page_size = gen_arena_page_size();
+        return (page_bytes(PAGE_SIZE) + os_page_size - 1) & ~(os_page_size - 1);
+    }
+
+    bool maps_pages() const {
+        return (_memory_options.huge_pages || _memory_options.numa_policy != GenArenaNumaPolicy::Default) &&
+               _allocator == gen_arena_default_allocator() &&
+               !gen_arena_buffer_is_mapped(_allocator, page_bytes(PAGE_SIZE), PAGE_ALIGNMENT);
+    }
+
+    // Takes a full page from the current slab, mapping a new one (with the memory options) when it's used up.
+    void* allocate_mapped_page() {
+        size_t stride = mapped_page_stride();
+        if (_slab_size < stride) {
+            size_t slab_size = GEN_ARENA_HUGE_PAGE_SIZE / stride * stride;
+            if (slab_size == 0) slab_size = stride;
+            void* slab = gen_arena_pages_alloc(slab_size, _memory_options.huge_pages ? GEN_ARENA_HUGE_PAGE_SIZE : 0);
+            if (slab == nullptr) return nullptr;
+            gen_arena_apply_memory_options(slab, slab_size, _memory_options);
+            if (_slab_size > 0) gen_arena_pages_free(_slab, _slab_size);
+            _slab = static_cast<char*>(slab);
+            _slab_size = slab_size;
+        }
+#ifdef GEN_ARENA_ENABLE_BUDGET
+        if (!GenArenaBudget::instance().acquire(page_bytes(PAGE_SIZE))) return nullptr;
+#endif
+        void* ptr = _slab;
+        _slab += stride;
+        _slab_size -= stride;
+        return ptr;
+    }
+#endif
+
+    GenArenaResult allocate_page(Page& page, uint32_t capacity) {
+        void* ptr = nullptr;
+        page.mapped = false;
+#ifdef GEN_ARENA_USE_MREMAP
+        if (capacity == PAGE_SIZE && maps_pages()) {
+            ptr = allocate_mapped_page();
+            page.mapped = ptr != nullptr;
+        } else
+#endif
+        ptr = gen_arena_buffer_realloc(_allocator, _memory_options, nullptr, 0, page_bytes(capacity), 0, PAGE_ALIGNMENT);
+        if (ptr == nullptr) return GenArenaResult::OutOfMemory;
+        page.indices = static_cast<Index*>(ptr);
+        page.generations = reinterpret_cast<Generation*>(static_cast<char*>(ptr) + sizeof(Index) * capacity);
+        return GenArenaResult::Ok;
+    }
+
+    void free_page_memory(const Page& page, uint32_t capacity) {
+#ifdef GEN_ARENA_USE_MREMAP
+        if (page.mapped) {
+#ifdef GEN_ARENA_ENABLE_BUDGET
+            GenArenaBudget::instance().release(page_bytes(capacity));
+#endif
+            gen_arena_pages_free(page.indices, mapped_page_stride());
+            return;
+        }
+#endif
+        gen_arena_buffer_free(_allocator, page.indices, page_bytes(capacity), PAGE_ALIGNMENT);
+    }
+
+    void free_page(uint32_t page) {
+        free_page_memory(_pages[page], page_capacity(page));
+        _pages[page].indices = empty_indices();
+        _pages[page].generations = empty_generations();
+        _pages[page].mapped = false;
+    }
+
+    GenArenaResult reserve_page_table(uint32_t page_count) {
+        if (page_count <= _page_table_capacity) return GenArenaResult::Ok;
+        uint32_t new_capacity = _page_table_capacity == 0 ? 1 : 2 * _page_table_capacity;
+        if (new_capacity < page_count) new_capacity = page_count;
+
+        void* new_pages = gen_arena_buffer_realloc(_allocator, _memory_options, _pages, sizeof(Page) * _page_table_capacity,
+                                                   sizeof(Page) * new_capacity, sizeof(Page) * _page_count, alignof(Page));
+        if (new_pages == nullptr) return GenArenaResult::OutOfMemory;
+        _pages = static_cast<Page*>(new_pages);
+        _page_table_capacity = new_capacity;
+        return GenArenaResult::Ok;
+    }
+
+    // Grows the first page (while it's the only one) by moving it to a new allocation.
+    GenArenaResult grow_first_page(uint32_t capacity) {
+        if (_page_count == 0) {
+            if (reserve_page_table(1) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+            if (allocate_page(_pages[0], capacity) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+            _pages[0].used = 0;
+            _pages[0].generation_floor = 1;
+            _pages[0].trimmed = false;
+            _page_count = 1;
+            _first_page_capacity = capacity;
+            return GenArenaResult::Ok;
+        }
+
+        Page old_page = _pages[0];
+        if (allocate_page(_pages[0], capacity) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+        memcpy(_pages[0].indices, old_page.indices, sizeof(Index) * _size);
+        memcpy(_pages[0].generations, old_page.generations, sizeof(Generation) * _size);
+        free_page_memory(old_page, _first_page_capacity);
+        _first_page_capacity = capacity;
+        return GenArenaResult::Ok;
+    }
+
+    // Allocates the first page that was freed by trim(), and appends its slots to the free list.
+    GenArenaResult restore_freed_page() {
+        uint32_t page = 0;
+        while (!is_freed(page)) page++;
+        if (allocate_page(_pages[page], PAGE_SIZE) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+        _freed_page_count--;
+
+        // Freed pages are always full pages below the last page, so all their slots were handed out before
+        uint32_t begin = page * PAGE_SIZE;
+        for (uint32_t slot = begin; slot < begin + PAGE_SIZE; slot++) {
+            set_generation(slot, _pages[page].generation_floor);
+            append(slot);
+        }
+        return GenArenaResult::Ok;
+    }
+
+    // Appends a free slot to the back of the free list.
+    void append(uint32_t slot) {
+        set_index(slot, NIL);
+        _length++;
+        if (_front == NIL) {
+            // If free list is empty, create new free list with one element
+            _back = _front = slot;
+        } else {
+            // Else, insert like what you would do with a singly-linked list
+            set_index(_back, slot);
+            _back = slot;
+        }
+    }
+
+    // Inserts a free slot at the front of the free list.
+    void prepend(uint32_t slot) {
+        set_index(slot, _front);
+        _length++;
+        _front = slot;
+        if (_back == NIL) _back = slot;
+    }
+
+public:
+    GenArenaResult setup(uint32_t initial_capacity, const GenArenaAllocator* allocator = gen_arena_default_allocator()) {
+        _allocator = allocator;
+        _memory_options = GenArenaMemoryOptions();
+        _growth_policy = gen_arena_default_growth_policy();
+        _reuse_policy = gen_arena_default_reuse_policy();
+        _pages = nullptr;
+        _page_count = 0;
+        _page_table_capacity = 0;
+        _freed_page_count = 0;
+        _first_page_capacity = 0;
+        _size = 0;
+        _front = NIL;
+        _back = NIL;
+        _length = 0;
+        _external = false;
+        _retired_count = 0;
+        _generation_floor = 1;
+#ifdef GEN_ARENA_USE_MREMAP
+        _slab = nullptr;
+        _slab_size = 0;
+#endif
+        return reserve(initial_capacity);
+    }
+
+    void release() {
+        for (uint32_t page = 0; page < _page_count; page++) {
+            if (!is_freed(page)) free_page(page);
+        }
+        gen_arena_buffer_free(_allocator, _pages, sizeof(Page) * _page_table_capacity, alignof(Page));
+#ifdef GEN_ARENA_USE_MREMAP
+        if (_slab_size > 0) gen_arena_pages_free(_slab, _slab_size);
+        _slab = nullptr;
+        _slab_size = 0;
+#endif
+        _pages = nullptr;
+        _page_count = 0;
+        _page_table_capacity = 0;
+        _freed_page_count = 0;
+        _first_page_capacity = 0;
+        _size = 0;
+        _front = NIL;
+        _back = NIL;
+        _length = 0;
+        _external = false;
+        _retired_count = 0;
+        _generation_floor = 1;
+    }
+
+    // Number of slots ever handed out (used, free and retired)
+    uint32_t size() const { return _size; }
+
+    // Number of slots that were retired since their generation saturated
+    uint32_t retired_count() const { return _retired_count; }
+
+    // Number of slots covered by the page table
+    uint32_t capacity() const { return _page_count == 0 ? 0 : _first_page_capacity + (_page_count - 1) * PAGE_SIZE; }
+
+    // Bytes of the allocated pages and the page table
+    size_t allocated_bytes() const {
+        size_t bytes = sizeof(Page) * _page_table_capacity;
+        for (uint32_t page = 0; page < _page_count; page++) {
+            if (!is_freed(page)) bytes += page_bytes(page_capacity(page));
+        }
+        return bytes;
+    }
+
+    bool empty() const { return _front == NIL; }
+
+    // Number of slots in the free list
+    uint32_t length() const { return _length; }
+
+    bool external() const { return _external; }
+
+    const GenArenaAllocator* allocator() const { return _allocator; }
+
+    const GenArenaMemoryOptions& memory_options() const { return _memory_options; }
+
+    // Applies to the pages allocated from now on, and to the current ones if they are mapped pages.
+    void set_memory_options(const GenArenaMemoryOptions& options) {
+        _memory_options = options;
+        for (uint32_t page = 0; page < _page_count; page++) {
+            size_t bytes = page_bytes(page_capacity(page));
+            if (!is_freed(page) && (_pages[page].mapped || gen_arena_buffer_is_mapped(_allocator, bytes, PAGE_ALIGNMENT))) {
+                gen_arena_apply_memory_options(_pages[page].indices, bytes, options);
+            }
+        }
+#ifdef GEN_ARENA_USE_MREMAP
+        if (_slab_size > 0) gen_arena_apply_memory_options(_slab, _slab_size, options);
+#endif
+    }
+
+    const GenArenaGrowthPolicy& growth_policy() const { return _growth_policy; }
+
+    void set_growth_policy(const GenArenaGrowthPolicy& policy) { _growth_policy = policy; }
+
+    const GenArenaReusePolicy& reuse_policy() const { return _reuse_policy; }
+
+    // Applies to the slots released from now on (the free slots keep their order).
+    void set_reuse_policy(const GenArenaReusePolicy& policy) { _reuse_policy = policy; }
+
+    // The slot should be below size() (slots of freed pages read as NIL).
+    uint32_t index(uint32_t slot) const { return _pages[slot / PAGE_SIZE].indices[slot % PAGE_SIZE]; }
+
+    uint32_t generation(uint32_t slot) const { return _pages[slot / PAGE_SIZE].generations[slot % PAGE_SIZE]; }
+
+    void set_index(uint32_t slot, uint32_t index) { _pages[slot / PAGE_SIZE].indices[slot % PAGE_SIZE] = (Index) index; }
+
+    void set_generation(uint32_t slot, uint32_t generation) {
+        _pages[slot / PAGE_SIZE].generations[slot % PAGE_SIZE] = (Generation) (generation & Ref::GENERATION_MASK);
+    }
+
+    // Prefetches the index and the generation of the slot (which should be below size()).
+    void prefetch(uint32_t slot) const {
+        const Page& page = _pages[slot / PAGE_SIZE];
+        gen_arena_prefetch(&page.indices[slot % PAGE_SIZE]);
+        gen_arena_prefetch(&page.generations[slot % PAGE_SIZE]);
+    }
+
+    // Allocates room for at least new_capacity slots.
+    GenArenaResult reserve(uint32_t new_capacity) {
+        if (new_capacity <= capacity()) return GenArenaResult::Ok;
+
+        // Grow the first page (doubling) until it's full
+        if (_page_count <= 1 && _first_page_capacity < PAGE_SIZE) {
+            uint32_t first_capacity = _first_page_capacity < MIN_PAGE_CAPACITY / 2 ? MIN_PAGE_CAPACITY : 2 * _first_page_capacity;
+            while (first_capacity < new_capacity && first_capacity < PAGE_SIZE) first_capacity *= 2;
+            if (grow_first_page(first_capacity) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+            if (new_capacity <= capacity()) return GenArenaResult::Ok;
+        }
+
+        uint32_t page_count = (uint32_t) (((uint64_t) new_capacity + PAGE_SIZE - 1) / PAGE_SIZE);
+        if (reserve_page_table(page_count) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+        while (_page_count < page_count) {
+            Page& page = _pages[_page_count];
+            if (allocate_page(page, PAGE_SIZE) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+            page.used = 0;
+            page.generation_floor = 1;
+            page.trimmed = false;
+            _page_count++;
+        }
+        return GenArenaResult::Ok;
+    }
+
+    // Takes a slot from the front of the free list, or appends a new one if the free list is empty (or only holds quarantined slots).
+    // The index of the acquired slot is left unspecified (the caller should set it).
+    GenArenaResult acquire(uint32_t& slot) {
+        // Slots of an external free list can only be attached with their refs
+        if (_external) return GenArenaResult::RefInvalid;
+        uint32_t quarantine = _reuse_policy.order == GenArenaReuseOrder::Fifo ? _reuse_policy.quarantine : 0;
+        if (_length <= quarantine && _freed_page_count > 0) {
+            if (restore_freed_page() == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+        }
+        // (Quarantined slots are still reused once all indices are taken)
+        if (_length <= quarantine && (_front == NIL || _size < NIL)) {
+            // The last index is reserved for NIL
+            if (_size == NIL) return GenArenaResult::OutOfMemory;
+            if (_size == capacity()) {
+                if (reserve(_size + 1) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+            }
+            slot = _size++;
+            set_index(slot, NIL);
+            set_generation(slot, _generation_floor);
+        } else {
+            slot = _front;
+            _front = index(slot);
+            if (_front == NIL) {
+                _back = NIL;
+            }
+            _length--;
+        }
+        _pages[slot / PAGE_SIZE].used++;
+        return GenArenaResult::Ok;
+    }
+
+    // Uses the given slot for an externally allocated ref, and makes the free list external (only allowed while it's empty).
+    // The slots in between that weren't used yet are marked as unused. The index of the slot is left to the caller.
+    GenArenaResult attach(uint32_t slot, uint32_t generation) {
+        if (!_external) {
+            if (_size != 0) return GenArenaResult::RefInvalid;
+            _external = true;
+        }
+        if (slot >= NIL) return GenArenaResult::RefInvalid;
+        if (reserve(slot + 1) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
+        while (_size <= slot) {
+            set_index(_size, NIL);
+            set_generation(_size, 0);
+            _size++;
+        }
+        set_generation(slot, generation);
+        _pages[slot / PAGE_SIZE].used++;
+        return GenArenaResult::Ok;
+    }
+
+    // Drops the slots from new_size on (which should all be free or retired), and frees the pages past them.
+    // Then frees the full pages below new_size whose slots are all free, after unlinking their slots from the free list.
+    // Retired slots are never dropped, since refs to them would become valid again once the slots are reused.
+    void trim(uint32_t new_size) {
+        if (new_size > _size) new_size = _size;
+        if (!_external && _retired_count > 0) {
+            // Slots past new_size aren't used, so the ones with a saturated generation are the retired ones
+            for (uint32_t slot = _size; slot > new_size; slot--) {
+                if (generation(slot - 1) == Ref::GENERATION_MASK) {
+                    new_size = slot;
+                    break;
+                }
+            }
+        }
+        uint32_t page_count = (uint32_t) (((uint64_t) new_size + PAGE_SIZE - 1) / PAGE_SIZE);
+
+        // Mark the full pages below new_size whose slots are all free
+        uint32_t full_pages = new_size / PAGE_SIZE;
+        uint32_t marked = 0;
+        if (!_external) {
+            for (uint32_t page = 0; page < full_pages; page++) {
+                Page& entry = _pages[page];
+                if (is_freed(page) || entry.used != 0) continue;
+                // Refs to the slots of the page have older generations than the slots have now
+                uint32_t floor = 1;
+                for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+                    if (entry.generations[i] > floor) floor = entry.generations[i];
+                }
+                // Pages with retired slots are kept
+                if (floor == Ref::GENERATION_MASK) continue;
+                entry.generation_floor = floor;
+                entry.trimmed = true;
+                marked++;
+            }
+        }
+
+        if (!_external && (new_size < _size || marked > 0)) {
+            // Unlink the dropped slots from the free list (keeping the order of the others)
+            uint32_t front = NIL;
+            uint32_t back = NIL;
+            _length = 0;
+            for (uint32_t slot = _front; slot != NIL;) {
+                uint32_t next = index(slot);
+                if (slot >= new_size) {
+                    if (generation(slot) > _generation_floor) _generation_floor = generation(slot);
+                } else if (!_pages[slot / PAGE_SIZE].trimmed) {
+                    if (front == NIL) {
+                        front = slot;
+                    } else {
+                        set_index(back, slot);
+                    }
+                    back = slot;
+                    _length++;
+                }
+                slot = next;
+            }
+            if (back != NIL) set_index(back, NIL);
+            _front = front;
+            _back = back;
+        }
+        // (Unused slots of an external free list get their generation from the ref when they are attached again)
+        _size = new_size;
+
+        for (uint32_t page = 0; page < _page_count; page++) {
+            if (page >= page_count) {
+                // Past the last slot, so it's dropped from the page table
+                if (is_freed(page)) {
+                    // (The free slots on other dropped pages raised the floor above, but the slots of freed pages aren't in the free list)
+                    if (_pages[page].generation_floor > _generation_floor) _generation_floor = _pages[page].generation_floor;
+                    _freed_page_count--;
+                } else {
+                    free_page(page);
+                }
+            } else if (_pages[page].trimmed) {
+                free_page(page);
+                _pages[page].trimmed = false;
+                _freed_page_count++;
+            }
+        }
+        _page_count = page_count;
+        if (_page_count == 0) _first_page_capacity = 0;
+    }
+
+    // Bumps the generation of a used slot (invalidating all refs to it), and links it into the free list:
+    // at the back with the Fifo reuse order, and at the front with Lifo.
+    // If the generation is saturated, bumping it would wrap around and make old refs valid again, so the slot is retired instead:
+    // it's left out of the free list for good (with a NIL index, so the refs to it stay invalid).
+    void push(uint32_t slot) {
+        _pages[slot / PAGE_SIZE].used--;
+        if (generation(slot) == Ref::GENERATION_MASK) {
+            set_index(slot, NIL);
+            _retired_count++;
+            return;
+        }
+        set_generation(slot, generation(slot) + 1);
+
+        // External slots are only reused by attach()
+        if (_external) {
+            set_index(slot, NIL);
+            return;
+        }
+        if (_reuse_policy.order == GenArenaReuseOrder::Lifo) {
+            prepend(slot);
+        } else {
+            append(slot);
+        }
+    }
+};
+
+/* Storage for the optional features of GenArenaRaw.
+ * These are specialized to be empty when unused by the Config (and used as base classes to get the empty base optimization),
+ * so that a GenArenaRaw<GenArenaConfig<X, 0, Y>> doesn't pay for type ids or groups at all. */
+
+template <bool has_type_id>
+class GenArenaTypeIdStorage {
+    uint32_t _tid;
+
+protected:
+    uint32_t stored_type_id() const { return _tid; }
+
+    void store_type_id(uint32_t tid) { _tid = tid; }
+};
+
+template <>
+class GenArenaTypeIdStorage<false> {
+protected:
+    static constexpr uint32_t stored_type_id() { return 0; }
+
+    void store_type_id(uint32_t) {}
+};
+
+// Only the inner group boundaries are stored, since the last group always ends at the end of the dense buffer.
+template <int group_count>
+class GenArenaGroupStorage {
+    uint32_t _group_bounds[group_count - 1];
+
+protected:
+    uint32_t group_bound(uint32_t group) const { return _group_bounds[group]; }
+
+    void set_group_bound(uint32_t group, uint32_t bound) { _group_bounds[group] = bound; }
+
+    void reset_group_bounds() {
+        for (uint32_t g = 0; g < group_count - 1; g++) _group_bounds[g] = 0;
+    }
+};
+
+template <>
+class GenArenaGroupStorage<1> {
+protected:
+    static constexpr uint32_t group_bound(uint32_t) { return 0; }
+
+    void set_group_bound(uint32_t, uint32_t) {}
+
+    void reset_group_bounds() {}
+};
+
+// A snapshot of the counters of an arena (see GenArenaRaw::stats()).
+struct GenArenaStats {
+    bool enabled; // If false, the counters (everything before size) are all zero since GEN_ARENA_ENABLE_STATS is off
+
+    uint64_t inserts;
+    uint64_t releases;
+    uint64_t resizes; // Successful reallocations of the dense buffers, including the growth on insert and the ones of shrink()
+    uint64_t resize_bytes_copied; // Buffers that are grown with mremap() aren't copied
+    uint64_t shrinks;
+    uint64_t trims;
+    uint64_t invalid_ref_lookups; // Invalid or stale refs passed to try_get() or release()
+    uint32_t peak_size;
+
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t free_list_size; // Number of slots ever handed out (used, free and retired)
+    uint32_t free_list_length; // Number of slots in the free list (not counting the slots of pages freed by trim())
+    uint32_t retired_slots; // Slots whose generation saturated, which are never reused
+};
+
+// Memory footprint and fragmentation of an arena (see GenArenaRaw::memory_report()).
+// Reserved bytes are the allocated buffer sizes, and used bytes are the parts that hold live items or handed out slots.
+struct GenArenaMemoryReport {
+    size_t item_bytes_reserved;
+    size_t item_bytes_used;
+    size_t metadata_bytes_reserved;
+    size_t metadata_bytes_used;
+    size_t sparse_bytes_reserved; // The pages and the page table of the free list
+    size_t sparse_bytes_used; // An index and a generation per slot ever handed out, so this doesn't go down when items are released
+
+    size_t total_bytes_reserved;
+    size_t total_bytes_used;
+
+    double live_ratio; // Live items per slot ever handed out (1 if no slots)
+    double sparse_to_dense_ratio; // Slots ever handed out per live item (0 if empty)
+    // Fraction of neighbours in the dense buffer whose slots are less than a cache line apart in the free list (1 if fewer than 2 items).
+    // This goes down as release() swaps items around, and foreach loops that also look up slots (like foreach_ref_val) get slower.
+    double locality;
+};
+
+enum class GenArenaCounter : uint32_t {
+    Inserts,
+    Releases,
+    Resizes,
+    ResizeBytesCopied,
+    Shrinks,
+    Trims,
+    InvalidRefLookups,
+    Count,
+};
+
+#ifdef GEN_ARENA_ENABLE_STATS
+
+#ifndef GEN_ARENA_STATS_SHARDS
+#define GEN_ARENA_STATS_SHARDS 8
+#endif
+
+// The counter shard of the calling thread. Threads are spread round-robin over the shards,
+// so threads only share a shard (and its cache line) once there are more than GEN_ARENA_STATS_SHARDS of them.
+inline uint32_t gen_arena_stats_shard() {
+    static std::atomic<uint32_t> next_shard(0);
+    static thread_local uint32_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % GEN_ARENA_STATS_SHARDS;
+    return shard;
+}
+
+class GenArenaStatsStorage {
+private:
+    static constexpr uint32_t COUNTER_COUNT = (uint32_t) GenArenaCounter::Count;
+
+    // A cache line per shard, so GEN_ARENA_STATS_SHARDS * 64 bytes per arena.
+    // Threads can share a shard, so the counters are updated with fetch_add (which is cheap while the line stays with one core).
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+    };
+
+    mutable Shard _shards[GEN_ARENA_STATS_SHARDS];
+    std::atomic<uint32_t> _peak_size;
+
+    void copy_from(const GenArenaStatsStorage& other) {
+        for (uint32_t s = 0; s < GEN_ARENA_STATS_SHARDS; s++) {
+            for (uint32_t c = 0; c < COUNTER_COUNT; c++) {
+                _shards[s].counters[c].store(other._shards[s].counters[c].load(std::memory_order_relaxed),
+                                             std::memory_order_relaxed);
+            }
+        }
+        _peak_size.store(other._peak_size.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+protected:
+    GenArenaStatsStorage() noexcept {
+        reset_stats();
+    }
+
+    GenArenaStatsStorage(const GenArenaStatsStorage& other) noexcept {
+        copy_from(other);
+    }
+
+    GenArenaStatsStorage& operator=(const GenArenaStatsStorage& other) noexcept {
+        copy_from(other);
+        return *this;
+    }
+
+    void count(GenArenaCounter counter, uint64_t amount = 1) const {
+        std::atomic<uint64_t>& value = _shards[gen_arena_stats_shard()].counters[(uint32_t) counter];
+        value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    void count_size(uint32_t size) {
+        uint32_t peak = _peak_size.load(std::memory_order_relaxed);
+        while (size > peak && !_peak_size.compare_exchange_weak(peak, size, std::memory_order_relaxed)) {}
+    }
+
+    void fill_stats(GenArenaStats& stats) const {
+        uint64_t totals[COUNTER_COUNT] = {};
+        for (uint32_t s = 0; s < GEN_ARENA_STATS_SHARDS; s++) {
+            for (uint32_t c = 0; c < COUNTER_COUNT; c++) {
+                totals[c] += _shards[s].counters[c].load(std::memory_order_relaxed);
+            }
+        }
+        stats.enabled = true;
+        stats.inserts = totals[(uint32_t) GenArenaCounter::Inserts];
+        stats.releases = totals[(uint32_t) GenArenaCounter::Releases];
+        stats.resizes = totals[(uint32_t) GenArenaCounter::Resizes];
+        stats.resize_bytes_copied = totals[(uint32_t) GenArenaCounter::ResizeBytesCopied];
+        stats.shrinks = totals[(uint32_t) GenArenaCounter::Shrinks];
+        stats.trims = totals[(uint32_t) GenArenaCounter::Trims];
+        stats.invalid_ref_lookups = totals[(uint32_t) GenArenaCounter::InvalidRefLookups];
+        stats.peak_size = _peak_size.load(std::memory_order_relaxed);
+    }
+
+public:
+    void reset_stats() {
+        for (uint32_t s = 0; s < GEN_ARENA_STATS_SHARDS; s++) {
+            for (uint32_t c = 0; c < COUNTER_COUNT; c++) {
+                _shards[s].counters[c].store(0, std::memory_order_relaxed);
+            }
+        }
+        _peak_size.store(0, std::memory_order_relaxed);
+    }
+};
+
+#else
+
+class GenArenaStatsStorage {
+protected:
+    void count(GenArenaCounter, uint64_t = 1) const {}
+
+    void count_size(uint32_t) {}
+
+    void fill_stats(GenArenaStats& stats) const {
+        stats = GenArenaStats();
+    }
+
+public:
+    void reset_stats() {}
+};
+
+#endif
+
+template <class Config>
+class GenArenaRaw : private GenArenaTypeIdStorage<(Config::TypeIdBits > 0)>,
+                    private GenArenaGroupStorage<Config::GroupCount>,
+                    public GenArenaStatsStorage {
+public:
+    using Ref = GenArenaRef<Config>;
+
+    static_assert(Config::GroupCount >= 1, "GenArenaConfig needs at least one group");
+
+private:
+    using TypeIdStorage = GenArenaTypeIdStorage<(Config::TypeIdBits > 0)>;
+    using GroupStorage = GenArenaGroupStorage<Config::GroupCount>;
+
+    static constexpr uint32_t LAST_GROUP = Config::GroupCount - 1;
+
+    uint32_t _item_size;
 
     void* _items;
     GenArenaMetadata* _metadata;
-    Ref* _free_list;
+    GenArenaFreeList<Config> _free_list;
 
-    uint32_t _item_size;
-    uint32_t _free_list_size;
     uint32_t _capacity;
-
-    uint32_t _tid;
+    // Capacity of the metadata buffer, which can be bigger than _capacity after a failed reallocation (see reallocate_dense())
+    uint32_t _metadata_capacity;
 
     uint32_t _tsize;
     uint32_t _talign;
 
-    uint32_t _free_list_front;
-    uint32_t _free_list_back;
+    const GenArenaAllocator* _allocator;
+
+    // The dense buffer is partitioned into Config::GroupCount contiguous ranges.
+    // Group g occupies [group_begin(g), group_end(g)), and the last group always ends at _item_size.
+    using GroupStorage::group_bound;
+    using GroupStorage::set_group_bound;
+
+    void* dense_addr(uint32_t dense_index) const {
+        return static_cast<char*>(_items) + _tsize * dense_index;
+    }
+
+    // Moves the item at dense index `from` into the (unused) slot `to`, keeping the free list in sync.
+    void move_dense(uint32_t from, uint32_t to) {
+        memmove(dense_addr(to), dense_addr(from), _tsize);
+        _metadata[to] = _metadata[from];
+        _free_list.set_index(_metadata[to].dense_to_sparse, to);
+    }
+
+    // Moves the dense buffers (items and metadata) into new buffers of the given capacity, which should be at least _item_size.
+    // The metadata buffer is grown before the items and shrunk after them, so if the second reallocation fails,
+    // the metadata buffer is just left bigger than needed (_metadata_capacity is never less than _capacity).
+    GenArenaResult reallocate_dense(uint32_t new_capacity) {
+        const size_t md_size = sizeof(GenArenaMetadata);
+        const size_t md_align = alignof(GenArenaMetadata);
+        const GenArenaMemoryOptions& options = _free_list.memory_options();
+
+        // (Checked before reallocating, since this depends on the old capacities)
+        size_t bytes_copied = 0;
+        if (new_capacity > _metadata_capacity) {
+            if (!gen_arena_buffer_is_remapped(_allocator, md_size * _metadata_capacity, md_size * new_capacity, md_align)) {
+                bytes_copied += md_size * _item_size;
+            }
+            void* new_metadata = gen_arena_buffer_realloc(_allocator, options, _metadata, md_size * _metadata_capacity,
+                                                          md_size * new_capacity, md_size * _item_size, md_align);
+            if (new_metadata == nullptr) return GenArenaResult::OutOfMemory;
+            _metadata = static_cast<GenArenaMetadata*>(new_metadata);
+            _metadata_capacity = new_capacity;
+        }
+
+        if (!gen_arena_buffer_is_remapped(_allocator, (size_t) _tsize * _capacity, (size_t) _tsize * new_capacity, _talign)) {
+            bytes_copied += (size_t) _tsize * _item_size;
+        }
+        void* new_items = gen_arena_buffer_realloc(_allocator, options, _items, (size_t) _tsize * _capacity,
+                                                   (size_t) _tsize * new_capacity, (size_t) _tsize * _item_size, _talign);
+        if (new_items == nullptr) return GenArenaResult::OutOfMemory;
+        _items = new_items;
+        _capacity = new_capacity;
+
+        if (new_capacity < _metadata_capacity) {
+            bool remapped = gen_arena_buffer_is_remapped(_allocator, md_size * _metadata_capacity, md_size * new_capacity, md_align);
+            void* new_metadata = gen_arena_buffer_realloc(_allocator, options, _metadata, md_size * _metadata_capacity,
+                                                          md_size * new_capacity, md_size * _item_size, md_align);
+            // (If shrinking fails, the bigger buffer is kept)
+            if (new_metadata != nullptr) {
+                if (!remapped) bytes_copied += md_size * _item_size;
+                _metadata = static_cast<GenArenaMetadata*>(new_metadata);
+                _metadata_capacity = new_capacity;
+            }
+        }
+
+        // Failed reallocations aren't counted
+        this->count(GenArenaCounter::Resizes);
+        this->count(GenArenaCounter::ResizeBytesCopied, bytes_copied);
+        return GenArenaResult::Ok;
+    }
+
+    void free_dense() {
+        gen_arena_buffer_free(_allocator, _items, (size_t) _tsize * _capacity, _talign);
+        gen_arena_buffer_free(_allocator, _metadata, sizeof(GenArenaMetadata) * _metadata_capacity, alignof(GenArenaMetadata));
+    }
+
+    // Swaps two live items in the dense buffer, keeping the free list in sync.
+    void swap_dense(uint32_t a, uint32_t b) {
+        if (a == b) return;
+
+        // Swap the item bytes through a small stack buffer, so that we don't need any allocations here.
+        unsigned char tmp[64];
+        unsigned char* pa = static_cast<unsigned char*>(dense_addr(a));
+        unsigned char* pb = static_cast<unsigned char*>(dense_addr(b));
+        for (uint32_t offset = 0; offset < _tsize; offset += sizeof(tmp)) {
+            uint32_t len = _tsize - offset < sizeof(tmp) ? _tsize - offset : (uint32_t) sizeof(tmp);
+            memcpy(tmp, pa + offset, len);
+            memcpy(pa + offset, pb + offset, len);
+            memcpy(pb + offset, tmp, len);
+        }
+
+        GenArenaMetadata md = _metadata[a];
+        _metadata[a] = _metadata[b];
+        _metadata[b] = md;
+
+        _free_list.set_index(_metadata[a].dense_to_sparse, a);
+        _free_list.set_index(_metadata[b].dense_to_sparse, b);
+    }
+
+    // Puts a new item for the (just acquired) slot into the dense buffers, and returns its address.
+    // Note that we don't need to check if we need to grow the buffers, this should already be done by the caller
+    void* place_new_item(uint32_t slot) {
+        // New items always go to group 0, so open up a hole at the front of each later group
+        // by moving its first item to its end. (This loop disappears when there is only one group.)
+        uint32_t dense_index = _item_size;
+        for (uint32_t g = LAST_GROUP; g > 0; g--) {
+            uint32_t begin = group_bound(g - 1);
+            if (begin != dense_index) move_dense(begin, dense_index);
+            dense_index = begin;
+            set_group_bound(g - 1, begin + 1);
+        }
+        _free_list.set_index(slot, dense_index);
+
+        // Insert to metadata buffer
+        _metadata[dense_index].dense_to_sparse = slot;
+
+        _item_size++;
+
+        this->count(GenArenaCounter::Inserts);
+        this->count_size(_item_size);
+
+        return dense_addr(dense_index);
+    }
+
+#ifdef GEN_ARENA_ENABLE_MEMORY_REGISTRY
+    static void report_memory(const void* arena, GenArenaMemoryReport& report) {
+        report = static_cast<const GenArenaRaw*>(arena)->memory_report();
+    }
+#endif
+
+    // The capacity that the dense buffers grow to when they are full (see GenArenaGrowthPolicy)
+    uint32_t next_capacity() const {
+        return gen_arena_grow_capacity(_free_list.growth_policy(), _capacity, _capacity + 1, _tsize, UINT32_MAX);
+    }
+
+    uint32_t group_of_dense(uint32_t dense_index) const {
+        uint32_t g = 0;
+        while (g < LAST_GROUP && dense_index >= group_bound(g)) g++;
+        return g;
+    }
 
 public:
-    GenArenaResult setup(uint32_t initial_capacity, uint32_t tsize, uint32_t talign, uint32_t tid) {
+    // The allocator is used for all buffers of the arena (nullptr means gen_arena_default_allocator()).
+    GenArenaResult setup(uint32_t initial_capacity, uint32_t tsize, uint32_t talign, uint32_t tid,
+                         const GenArenaAllocator* allocator = nullptr) {
         _item_size = 0;
-        _free_list_size = 0;
-        _capacity = initial_capacity;
+        _capacity = 0;
+        _metadata_capacity = 0;
+        _items = nullptr;
+        _metadata = nullptr;
 
-        _tid = tid;
+        this->store_type_id(tid & Ref::TYPE_ID_MASK);
 
         _tsize = tsize;
         _talign = talign;
+        _allocator = allocator != nullptr ? allocator : gen_arena_default_allocator();
 
-        _free_list_front = NIL;
-        _free_list_back = NIL;
+        this->reset_group_bounds();
+        this->reset_stats();
 
-        if (initial_capacity == 0) {
-            _items = nullptr;
-            _metadata = nullptr;
-            _free_list = nullptr;
-        } else {
-            _items = gen_arena_aligned_alloc(_tsize * _capacity, _talign);
-            if (_items == nullptr) return GenArenaResult::OutOfMemory;
-
-            _metadata = gen_arena_new_array<GenArenaMetadata>(_capacity);
-            if (_metadata == nullptr) return GenArenaResult::OutOfMemory;
+#ifdef GEN_ARENA_ENABLE_MEMORY_REGISTRY
+        GenArenaMemoryRegistry::instance().add(this, &GenArenaRaw::report_memory);
+#endif
 
-            _free_list = gen_arena_new_array<Ref>(_capacity);
-            if (_free_list == nullptr) return GenArenaResult::OutOfMemory;
-        }
-        return GenArenaResult::Ok;
+        GenArenaResult res = _free_list.setup(initial_capacity, _allocator);
+        if (res != GenArenaResult::Ok || initial_capacity == 0) return res;
+        return reallocate_dense(initial_capacity);
     }
 
     void release() {
-        gen_arena_aligned_free(_items);
-        gen_arena_aligned_free(_free_list);
-        gen_arena_aligned_free(_metadata);
+        free_dense();
+        _free_list.release();
 
         _items = nullptr;
-        _free_list = nullptr;
         _metadata = nullptr;
 
         _item_size = 0;
-        _free_list_size = 0;
         _capacity = 0;
+        _metadata_capacity = 0;
+
+        this->reset_group_bounds();
+
+#ifdef GEN_ARENA_ENABLE_MEMORY_REGISTRY
+        GenArenaMemoryRegistry::instance().remove(this);
+#endif
+    }
 
-        _free_list_front = NIL;
-        _free_list_back = NIL;
+    // Names the arena in the memory registry (see GEN_ARENA_ENABLE_MEMORY_REGISTRY), which only stores the pointer.
+    // The name sticks to this arena object until release().
+    void set_name(const char* name) {
+#ifdef GEN_ARENA_ENABLE_MEMORY_REGISTRY
+        GenArenaMemoryRegistry::instance().set_name(this, name);
+#else
+        (void) name;
+#endif
     }
 
     uint32_t size() const { return _item_size; }
 
-    uint32_t free_list_size() const { return _free_list_size; }
+    static constexpr uint32_t group_count() { return Config::GroupCount; }
+
+    uint32_t group_begin(uint32_t group) const {
+        gen_arena_assert(group < Config::GroupCount);
+        return group == 0 ? 0 : group_bound(group - 1);
+    }
+
+    uint32_t group_end(uint32_t group) const {
+        gen_arena_assert(group < Config::GroupCount);
+        return group == LAST_GROUP ? _item_size : group_bound(group);
+    }
+
+    uint32_t group_size(uint32_t group) const { return group_end(group) - group_begin(group); }
+
+    uint32_t free_list_size() const { return _free_list.size(); }
+
+    uint32_t free_list_capacity() const { return _free_list.capacity(); }
 
     uint32_t capacity() const { return _capacity; }
 
-    uint32_t type_id() const { return _tid; }
+    uint32_t type_id() const { return this->stored_type_id(); }
 
     uint32_t type_size() const { return _tsize; }
 
     uint32_t type_alignment() const { return _talign; }
 
+    const GenArenaAllocator* allocator() const { return _allocator; }
+
+    const GenArenaMemoryOptions& memory_options() const { return _free_list.memory_options(); }
+
+    const GenArenaGrowthPolicy& growth_policy() const { return _free_list.growth_policy(); }
+
+    // Sets how the dense buffers and the free list grow when they are full. This is reset by setup().
+    void set_growth_policy(const GenArenaGrowthPolicy& policy) { _free_list.set_growth_policy(policy); }
+
+    const GenArenaReusePolicy& reuse_policy() const { return _free_list.reuse_policy(); }
+
+    // Sets the order in which released slots are reused (FIFO by default). This is reset by setup().
+    void set_reuse_policy(const GenArenaReusePolicy& policy) { _free_list.set_reuse_policy(policy); }
+
+    // Takes a snapshot of the counters (see GEN_ARENA_ENABLE_STATS) and the current sizes.
+    GenArenaStats stats() const {
+        GenArenaStats stats;
+        this->fill_stats(stats);
+        stats.size = _item_size;
+        stats.capacity = _capacity;
+        stats.free_list_size = _free_list.size();
+        stats.retired_slots = _free_list.retired_count();
+        stats.free_list_length = _free_list.length();
+        return stats;
+    }
+
+    // Reports the bytes of each buffer and how fragmented the arena is. This scans the metadata buffer, so it's O(size()).
+    GenArenaMemoryReport memory_report() const {
+        GenArenaMemoryReport report;
+        report.item_bytes_reserved = (size_t) _tsize * _capacity;
+        report.item_bytes_used = (size_t) _tsize * _item_size;
+        report.metadata_bytes_reserved = sizeof(GenArenaMetadata) * _metadata_capacity;
+        report.metadata_bytes_used = sizeof(GenArenaMetadata) * _item_size;
+        report.sparse_bytes_reserved = _free_list.allocated_bytes();
+        report.sparse_bytes_used = (sizeof(typename GenArenaFreeList<Config>::Index) +
+                                    sizeof(typename GenArenaFreeList<Config>::Generation)) * _free_list.size();
+        report.total_bytes_reserved = report.item_bytes_reserved + report.metadata_bytes_reserved + report.sparse_bytes_reserved;
+        report.total_bytes_used = report.item_bytes_used + report.metadata_bytes_used + report.sparse_bytes_used;
+
+        uint32_t slot_count = _free_list.size();
+        report.live_ratio = slot_count == 0 ? 1.0 : (double) _item_size / slot_count;
+        report.sparse_to_dense_ratio = _item_size == 0 ? 0.0 : (double) slot_count / _item_size;
+
+        report.locality = 1.0;
+        if (_item_size >= 2) {
+            const uint32_t slots_per_line = 64 / sizeof(typename GenArenaFreeList<Config>::Index);
+            uint32_t near = 0;
+            for (uint32_t i = 1; i < _item_size; i++) {
+                uint32_t a = _metadata[i - 1].dense_to_sparse;
+                uint32_t b = _metadata[i].dense_to_sparse;
+                if ((a < b ? b - a : a - b) < slots_per_line) near++;
+            }
+            report.locality = (double) near / (_item_size - 1);
+        }
+        return report;
+    }
+
+    // Sets the placement options (huge pages, NUMA policy) of all buffers. They are only hints for the buffers that are mapped pages,
+    // and apply to the pages that are touched from now on (so it's best to set them right after setup()).
+    // They are reset by setup().
+    void set_memory_options(const GenArenaMemoryOptions& options) {
+        _free_list.set_memory_options(options);
+        if (_items != nullptr && gen_arena_buffer_is_mapped(_allocator, (size_t) _tsize * _capacity, _talign)) {
+            gen_arena_apply_memory_options(_items, (size_t) _tsize * _capacity, options);
+        }
+        if (_metadata != nullptr &&
+            gen_arena_buffer_is_mapped(_allocator, sizeof(GenArenaMetadata) * _metadata_capacity, alignof(GenArenaMetadata))) {
+            gen_arena_apply_memory_options(_metadata, sizeof(GenArenaMetadata) * _metadata_capacity, options);
+        }
+    }
+
     const void* item_buf() const { return _items; }
 
     void* item_buf() { return _items; }
@@ -142,42 +1495,39 @@ public:
 
     GenArenaMetadata* metadata_buf() { return _metadata; }
 
-    const Ref* free_list_buf() const { return _free_list; }
-
-    Ref* free_list_buf() { return _free_list; }
+    // The sparse arrays (with the generation of each slot, and its dense index while it's in use)
+    const GenArenaFreeList<Config>& free_list() const { return _free_list; }
 
     GenArenaResult resize(uint32_t new_capacity) {
+        GEN_ARENA_TRACE_SCOPE("GenArenaRaw::resize");
         if (new_capacity < _item_size) {
             return GenArenaResult::ResizeInvalid;
         }
 
-        void* new_items = gen_arena_aligned_alloc(_tsize * new_capacity, _talign);
-        if (new_items == nullptr) return GenArenaResult::OutOfMemory;
-
-        GenArenaMetadata* new_metadata = gen_arena_new_array<GenArenaMetadata>(new_capacity);
-        if (new_metadata == nullptr) return GenArenaResult::OutOfMemory;
-
-        Ref* new_free_list = gen_arena_new_array<Ref>(new_capacity);
-        if (new_free_list == nullptr) return GenArenaResult::OutOfMemory;
+        // Also make room in the free list, so that inserts up to new_capacity won't allocate
+        if (_free_list.reserve(new_capacity) == GenArenaResult::OutOfMemory) return GenArenaResult::OutOfMemory;
 
-        memcpy(new_items, _items, _tsize * _item_size);
-        memcpy(new_metadata, _metadata, sizeof(GenArenaMetadata) * _item_size);
-        memcpy(new_free_list, _free_list, sizeof(Ref) * _free_list_size);
-
-        gen_arena_aligned_free(_items);
-        gen_arena_delete_array(_metadata);
-        gen_arena_delete_array(_free_list);
+        return reallocate_dense(new_capacity);
+    }
 
-        _items = new_items;
-        _metadata = new_metadata;
-        _free_list = new_free_list;
-        _capacity = new_capacity;
+    // Grows the dense buffers (items and metadata) to at least the given capacity, but leaves the free list alone.
+    GenArenaResult reserve_dense(uint32_t capacity) {
+        GEN_ARENA_TRACE_SCOPE("GenArenaRaw::reserve_dense");
+        if (capacity <= _capacity) return GenArenaResult::Ok;
+        return reallocate_dense(capacity);
+    }
 
-        return GenArenaResult::Ok;
+    // Grows the free list to at least the given number of slots, but leaves the dense buffers alone.
+    // This is for arenas that hand out many more refs over their lifetime than they have live items at once.
+    GenArenaResult reserve_sparse(uint32_t slot_count) {
+        return _free_list.reserve(slot_count);
     }
 
     // Shrink buffers to nearest power-of-two capacity.
     GenArenaResult shrink() {
+        GEN_ARENA_TRACE_SCOPE("GenArenaRaw::shrink");
+        this->count(GenArenaCounter::Shrinks);
+
         // We really don't need to shrink when current item size is this small.
         // Besides we need to make sure gen_arena_clz(0) doesn't produce undefined behavior.
         if (_item_size <= 1) return GenArenaResult::Ok;
@@ -185,56 +1535,69 @@ public:
         // Nearest power-of-two calculation using clz() operation
         uint32_t new_capacity = 1 << (32 - gen_arena_clz(_item_size - 1));
 
-        void* new_items = gen_arena_aligned_alloc(_tsize * new_capacity, _talign);
-        if (new_items == nullptr) return GenArenaResult::OutOfMemory;
+        return reallocate_dense(new_capacity);
+    }
 
-        GenArenaMetadata* new_metadata = gen_arena_new_array<GenArenaMetadata>(new_capacity);
-        if (new_metadata == nullptr) return GenArenaResult::OutOfMemory;
+    // Returns the memory of the unused parts of the buffers to the OS in place (unlike shrink(), this doesn't move or copy anything).
+    // Whole pages of the items and metadata beyond size() are discarded, and free slots at the end of the free list are dropped.
+    // The capacity stays the same, and the discarded pages are faulted back in (zeroed) when the arena grows into them again.
+    // Note that pages can only be discarded for buffers that are mapped pages (see GEN_ARENA_USE_MREMAP).
+    void trim() {
+        GEN_ARENA_TRACE_SCOPE("GenArenaRaw::trim");
+        this->count(GenArenaCounter::Trims);
+
+        // Slots after the last used one are all free
+        uint32_t slot_end = 0;
+        for (uint32_t i = 0; i < _item_size; i++) {
+            uint32_t slot = _metadata[i].dense_to_sparse;
+            if (slot >= slot_end) slot_end = slot + 1;
+        }
+        _free_list.trim(slot_end);
 
-        memcpy(new_items, _items, _tsize * _item_size);
-        memcpy(new_metadata, _metadata, sizeof(GenArenaMetadata) * _item_size);
+        gen_arena_buffer_discard_tail(_allocator, _items, (size_t) _tsize * _capacity, (size_t) _tsize * _item_size, _talign);
+        gen_arena_buffer_discard_tail(_allocator, _metadata, sizeof(GenArenaMetadata) * _metadata_capacity,
+                                      sizeof(GenArenaMetadata) * _item_size, alignof(GenArenaMetadata));
+    }
 
-        gen_arena_aligned_free(_items);
-        gen_arena_delete_array(_metadata);
+    GenArenaResult insert_empty(void*& new_item_addr, Ref& ref, uint32_t userdata = 0) {
+        // Grow the dense buffers first. (Note that the free list might have free slots while the dense buffers are full, after a shrink())
+        if (_item_size == _capacity) {
+            if (resize(next_capacity()) == GenArenaResult::OutOfMemory) {
+                return GenArenaResult::OutOfMemory;
+            }
+        }
 
-        _items = new_items;
-        _metadata = new_metadata;
-        _capacity = new_capacity;
+        uint32_t slot;
+        GenArenaResult res = _free_list.acquire(slot);
+        if (res != GenArenaResult::Ok) return res;
+        ref.set(slot, type_id(), _free_list.generation(slot));
 
+        new_item_addr = place_new_item(slot);
+
+        // Return the results
         return GenArenaResult::Ok;
     }
 
-    GenArenaResult insert_empty(void*& new_item_addr, Ref& ref, uint32_t userdata = 0) {
-        if (_free_list_front == NIL) {
-                    gen_arena_assert(_item_size == _free_list_size);
-            ref = {_free_list_size, _tid, 1};
-            if (_free_list_size == _capacity) {
-                if (resize(_capacity == 0 ? 1 : 2 * _capacity) == GenArenaResult::OutOfMemory) {
-                    return GenArenaResult::OutOfMemory;
-                }
-            }
-            _free_list[_free_list_size++] = ref;
-        } else {
-            Ref& node = _free_list[_free_list_front];
-            uint32_t new_index = _free_list_front;
-            _free_list_front = node.index;
-            if (_free_list_front == NIL) {
-                _free_list_back = NIL;
+    // Inserts an item under an externally allocated ref (for example from a GenHandleAllocator),
+    // so that several arenas can share the same index space. The arena adopts the type id of the refs.
+    // Once this is used, refs can't be allocated with insert_empty() anymore (and vice versa).
+    GenArenaResult insert_empty_at(Ref ref, void*& new_item_addr) {
+        uint32_t slot = ref.index();
+        if (slot < _free_list.size() && _free_list.index(slot) < _item_size) {
+            // There's already an item for this slot
+            return GenArenaResult::RefInvalid;
+        }
+        if (_item_size == _capacity) {
+            if (resize(next_capacity()) == GenArenaResult::OutOfMemory) {
+                return GenArenaResult::OutOfMemory;
             }
-            node.index = _item_size;
-            ref = {new_index, _tid, node.generation};
         }
 
-        // Insert to item buffer
-        // Note that we don't need to check if we need to grow the buffer, this has already been done above
-        new_item_addr = static_cast<unsigned char*>(_items) + _tsize * _item_size;
+        GenArenaResult res = _free_list.attach(slot, ref.generation());
+        if (res != GenArenaResult::Ok) return res;
+        this->store_type_id(ref.type_id());
 
-        // Insert to metadata buffer
-        _metadata[_item_size].dense_to_sparse = ref.index;
-
-        _item_size++;
-
-        // Return the results
+        new_item_addr = place_new_item(slot);
         return GenArenaResult::Ok;
     }
 
@@ -251,42 +1614,27 @@ public:
 
     template <class Deleter>
     GenArenaResult release_with_deleter(Ref ref, Deleter&& deleter_fun) {
-        if (ref.index >= _free_list_size) return GenArenaResult::RefInvalid;
-
-        Ref& node = _free_list[ref.index];
-
-        if (node.index >= _item_size || node.generation != ref.generation) return GenArenaResult::RefInvalid;
-
-        uint32_t prev_index = node.index;
-        node.index = NIL;
-        node.generation++;
-
-        // Free list deletion
-        if (_free_list_front == NIL) {
-            // If free list is empty, create new free list with one element
-            _free_list_back = _free_list_front = ref.index;
-        } else {
-            // Else, insert like what you would do with a singly-linked list
-            _free_list[_free_list_back].index = ref.index;
-            _free_list_back = ref.index;
+        if (!is_valid_ref(ref)) {
+            this->count(GenArenaCounter::InvalidRefLookups);
+            return GenArenaResult::RefInvalid;
         }
-        _free_list[_free_list_back].index = NIL;
+        this->count(GenArenaCounter::Releases);
 
-        // If the item to release in the buffer isn't at the end,
-        // Do a remove-swap operation to remove it. (Both the item and its metadata)
-        if (prev_index != _item_size - 1) {
-            // Before overriding the would-be-deleted item, call the custom deleter function.
-            deleter_fun(static_cast<char*>(_items) + _tsize * prev_index);
+        uint32_t prev_index = _free_list.index(ref.index());
+        _free_list.push(ref.index());
 
-            // Move the last item to the empty slot
-            memmove(static_cast<char*>(_items) + _tsize * prev_index,
-                    static_cast<char*>(_items) + _tsize * (_item_size - 1), _tsize);
+        // Before overriding the would-be-deleted item, call the custom deleter function.
+        deleter_fun(dense_addr(prev_index));
 
-            // Also do this for metadata buffer
-            _metadata[prev_index] = _metadata[_item_size - 1];
-
-            // Don't forget to update the free list for the swapped item!
-            _free_list[_metadata[prev_index].dense_to_sparse].index = prev_index;
+        // Do a remove-swap operation to remove it. (Both the item and its metadata)
+        // The hole is filled with the last item of its group, which leaves a hole at the front of the next group,
+        // and so on until the hole reaches the end of the dense buffer.
+        uint32_t hole = prev_index;
+        for (uint32_t g = group_of_dense(prev_index); g <= LAST_GROUP; g++) {
+            uint32_t last = group_end(g) - 1;
+            if (hole != last) move_dense(last, hole);
+            hole = last;
+            if (g < LAST_GROUP) set_group_bound(g, last);
         }
 
         _item_size--;
@@ -294,19 +1642,42 @@ public:
         return GenArenaResult::Ok;
     }
 
+    // Releases the items of all valid refs in the array (invalid or stale refs are skipped), and returns how many were released.
+    // The sparse nodes of the refs a few steps ahead are prefetched, since batches of refs usually point all over the arena.
+    // (RefType can be any type derived from Ref, like typed refs.)
+    template <class RefType, class Deleter>
+    uint32_t release_batch_with_deleter(const RefType* refs, uint32_t count, Deleter&& deleter_fun) {
+        GEN_ARENA_TRACE_SCOPE("GenArenaRaw::release_batch");
+        const uint32_t PREFETCH_DISTANCE = 8;
+        uint32_t released = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (i + PREFETCH_DISTANCE < count && refs[i + PREFETCH_DISTANCE].index() < _free_list.size()) {
+                _free_list.prefetch(refs[i + PREFETCH_DISTANCE].index());
+            }
+            if (release_with_deleter(refs[i], deleter_fun) == GenArenaResult::Ok) released++;
+        }
+        return released;
+    }
+
     bool is_valid_ref(Ref ref) const {
-        if (ref.index >= _free_list_size) return false;
-        auto node = _free_list[ref.index];
-        return node.index < _item_size && node.generation == ref.generation;
+        if (ref.index() >= _free_list.size()) return false;
+#ifdef GEN_ARENA_USE_TYPE_ID
+        if (ref.type_id() != type_id()) return false;
+#endif
+        uint32_t slot = ref.index();
+        return _free_list.index(slot) < _item_size && _free_list.generation(slot) == ref.generation();
     }
 
     const void* get(Ref ref) const {
-                gen_arena_assert(ref.index < _free_list_size);
-        auto node = _free_list[ref.index];
-                gen_arena_assert(node.generation == ref.generation);
-                gen_arena_assert(node.index < _item_size);
-
-        return static_cast<void*>(static_cast<char*>(_items) + _tsize * node.index);
+                gen_arena_assert(ref.index() < _free_list.size());
+#ifdef GEN_ARENA_USE_TYPE_ID
+                gen_arena_assert(ref.type_id() == type_id());
+#endif
+        uint32_t dense_index = _free_list.index(ref.index());
+                gen_arena_assert(_free_list.generation(ref.index()) == ref.generation());
+                gen_arena_assert(dense_index < _item_size);
+
+        return static_cast<void*>(static_cast<char*>(_items) + _tsize * dense_index);
     }
 
     void* get(Ref ref) {
@@ -314,25 +1685,96 @@ public:
     }
 
     const void* try_get(Ref ref) const {
-        auto node = _free_list[ref.index];
-
-        if (node.generation == ref.generation) {
-            return static_cast<void*>(static_cast<char*>(_items) + _tsize * node.index);
-        } else {
+        if (!is_valid_ref(ref)) {
+            this->count(GenArenaCounter::InvalidRefLookups);
             return nullptr;
         }
+        return dense_addr(_free_list.index(ref.index()));
     }
 
     void* try_get(Ref ref) {
         return const_cast<void*>(const_cast<const GenArenaRaw<Config>*>(this)->try_get(ref));
     }
 
+    // Prefetches the sparse entry of the ref (its index and generation), so that a get() of it a bit later doesn't stall on it.
+    // Refs past the end of the free list are ignored.
+    void prefetch(Ref ref) const {
+        if (ref.index() < _free_list.size()) _free_list.prefetch(ref.index());
+    }
+
+    // Calls fun(ref, item_addr) for each valid ref in the array, in order (invalid or stale refs are skipped), and returns how many were visited.
+    // Each lookup is two dependent cache misses (the sparse entry, then the item), so this runs a software pipeline instead:
+    // the sparse entries of the refs SPARSE_DISTANCE steps ahead are prefetched, and the items DENSE_DISTANCE steps ahead
+    // (whose sparse entries have arrived by then), so that the misses of many refs overlap.
+    // Only the first cache line of each item is prefetched. The refs are checked when fun is called, so fun may modify the arena.
+    // (RefType can be any type derived from Ref, like typed refs.)
+    template <class RefType, class Fun>
+    uint32_t get_pipelined(const RefType* refs, uint32_t count, Fun&& fun) const {
+        GEN_ARENA_TRACE_SCOPE("GenArenaRaw::get_pipelined");
+        const uint32_t SPARSE_DISTANCE = 16;
+        const uint32_t DENSE_DISTANCE = 8;
+        uint32_t visited = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (i + SPARSE_DISTANCE < count) prefetch(refs[i + SPARSE_DISTANCE]);
+            if (i + DENSE_DISTANCE < count && refs[i + DENSE_DISTANCE].index() < _free_list.size()) {
+                uint32_t dense_index = _free_list.index(refs[i + DENSE_DISTANCE].index());
+                if (dense_index < _item_size) gen_arena_prefetch(dense_addr(dense_index));
+            }
+
+            if (!is_valid_ref(refs[i])) {
+                this->count(GenArenaCounter::InvalidRefLookups);
+                continue;
+            }
+            fun(refs[i], dense_addr(_free_list.index(refs[i].index())));
+            visited++;
+        }
+        return visited;
+    }
+
+    // Moves the item into the given group with at most (Config::GroupCount - 1) swaps.
+    GenArenaResult set_group(Ref ref, uint32_t group) {
+        if (!is_valid_ref(ref)) return GenArenaResult::RefInvalid;
+        if (group >= Config::GroupCount) return GenArenaResult::GroupInvalid;
+
+        uint32_t dense_index = _free_list.index(ref.index());
+        uint32_t cur = group_of_dense(dense_index);
+        while (cur < group) {
+            // Swap to the back of the current group, then shift the boundary left
+            uint32_t last = group_bound(cur) - 1;
+            swap_dense(dense_index, last);
+            dense_index = last;
+            set_group_bound(cur, last);
+            cur++;
+        }
+        while (cur > group) {
+            // Swap to the front of the current group, then shift the boundary right
+            uint32_t begin = group_bound(cur - 1);
+            swap_dense(dense_index, begin);
+            dense_index = begin;
+            set_group_bound(cur - 1, begin + 1);
+            cur--;
+        }
+        return GenArenaResult::Ok;
+    }
+
+    // Swaps two items in the dense buffer (both of them should be in the same group), keeping refs to them valid.
+    // This is for containers that need a specific dense order, like GenArenaOwningGroup.
+    void swap_items(uint32_t dense_a, uint32_t dense_b) {
+        gen_arena_assert(dense_a < _item_size && dense_b < _item_size);
+        gen_arena_assert(group_of_dense(dense_a) == group_of_dense(dense_b));
+        swap_dense(dense_a, dense_b);
+    }
+
+    uint32_t get_group(Ref ref) const {
+        return group_of_dense(get_item_idx(ref));
+    }
+
     uint32_t get_item_idx(Ref ref) const {
-                gen_arena_assert(ref.index < _free_list_size);
-        auto node = _free_list[ref.index];
-                gen_arena_assert(node.generation == ref.generation);
-                gen_arena_assert(node.index < _item_size);
+                gen_arena_assert(ref.index() < _free_list.size());
+        uint32_t dense_index = _free_list.index(ref.index());
+                gen_arena_assert(_free_list.generation(ref.index()) == ref.generation());
+                gen_arena_assert(dense_index < _item_size);
 
-        return node.index;
+        return dense_index;
     }
 };
@@ -0,0 +1,234 @@
+#pragma once
+
+/**
+ * A registry of generational arenas, owning one GenArenaRaw per registered type.
+ * All arenas share the same Config, so untyped refs (GenArenaRef<Config>) can be stored anywhere,
+ * and resolved to their owning arena in O(1) by their type id.
+ * visit() then dispatches to the item's static type using a jump table that is generated at compile time,
+ * so this can replace a virtual-dispatch store without any pointer chasing.
+ *
+ * Every registered type must have a unique type id declared via gen_arena_type_id<T>().
+ */
+
+#include <gen_arena.h>
+
+template <class T, class... Types>
+struct GenArenaTypeIndex;
+
+template <class T, class... Types>
+struct GenArenaTypeIndex<T, T, Types...> {
+    static constexpr uint32_t value = 0;
+};
+
+template <class T, class U, class... Types>
+struct GenArenaTypeIndex<T, U, Types...> {
+    static constexpr uint32_t value = 1 + GenArenaTypeIndex<T, Types...>::value;
+};
+
+template <class Config, class... Types>
+class GenArenaRegistry {
+public:
+    using Ref = GenArenaRef<Config>;
+
+    template <class T>
+    using TypedRef = GenArenaTypedRef<T, Config>;
+
+    static constexpr uint32_t TYPE_COUNT = sizeof...(Types);
+
+    static_assert(Config::TypeIdBits > 0 && Config::TypeIdBits <= 16,
+                  "GenArenaRegistry needs a Config with 1 to 16 type id bits");
+    static_assert(TYPE_COUNT > 0 && TYPE_COUNT < 0xff, "GenArenaRegistry supports 1 to 254 types");
+
+private:
+    static constexpr uint32_t TYPE_ID_COUNT = 1u << Config::TypeIdBits;
+    static constexpr uint8_t NIL_SLOT = 0xff;
+
+    GenArenaRaw<Config> _arenas[TYPE_COUNT];
+
+    // Maps type ids to indices into _arenas (NIL_SLOT for unregistered type ids)
+    uint8_t _slots[TYPE_ID_COUNT];
+
+    template <class T>
+    static void destroy_item(void* ptr) {
+        static_cast<T*>(ptr)->~T();
+    }
+
+    template <class T>
+    static void destroy_all(GenArenaRaw<Config>& raw) {
+        T* items = static_cast<T*>(raw.item_buf());
+        for (uint32_t i = 0; i < raw.size(); i++) {
+            items[i].~T();
+        }
+    }
+
+    template <class T, class Fun>
+    static void visit_item(void* ptr, Fun& fun) {
+        fun(*static_cast<T*>(ptr));
+    }
+
+    template <class T>
+    int register_type() {
+        uint32_t slot = GenArenaTypeIndex<T, Types...>::value;
+        uint32_t tid = gen_arena_type_id<T>();
+        gen_arena_assert(tid < TYPE_ID_COUNT);
+        gen_arena_assert(_slots[tid] == NIL_SLOT); // type ids should be unique!
+        _slots[tid] = (uint8_t) slot;
+        return setup_arena<T>();
+    }
+
+    template <class T>
+    int setup_arena() {
+        // setup() with zero capacity guarantees it will succeed without any errors.
+        GenArenaResult res = raw<T>().setup(0, sizeof(T), alignof(T), gen_arena_type_id<T>());
+        (void) res;
+        return 0;
+    }
+
+    void release_arenas() {
+        static void (* const destroyers[])(GenArenaRaw<Config>&) = {&destroy_all<Types>...};
+        for (uint32_t i = 0; i < TYPE_COUNT; i++) {
+            destroyers[i](_arenas[i]);
+            _arenas[i].release();
+        }
+    }
+
+    uint32_t slot_of(Ref ref) const {
+        return _slots[ref.type_id()];
+    }
+
+public:
+    GenArenaRegistry() noexcept {
+        for (uint32_t i = 0; i < TYPE_ID_COUNT; i++) _slots[i] = NIL_SLOT;
+        int dummy[] = {register_type<Types>()...};
+        (void) dummy;
+    }
+
+    ~GenArenaRegistry() noexcept {
+        release_arenas();
+    }
+
+    GenArenaRegistry(const GenArenaRegistry& other) = delete;
+
+    GenArenaRegistry& operator=(const GenArenaRegistry& other) = delete;
+
+    // Releases all items and buffers. The registry is then empty (and can be used again), so releasing it twice is a no-op.
+    void release() {
+        release_arenas();
+        int dummy[] = {setup_arena<Types>()...};
+        (void) dummy;
+    }
+
+    template <class T>
+    GenArenaRaw<Config>& raw() {
+        return _arenas[GenArenaTypeIndex<T, Types...>::value];
+    }
+
+    template <class T>
+    const GenArenaRaw<Config>& raw() const {
+        return _arenas[GenArenaTypeIndex<T, Types...>::value];
+    }
+
+    // Returns the arena that owns the given ref, or nullptr if its type id isn't registered.
+    GenArenaRaw<Config>* resolve(Ref ref) {
+        uint32_t slot = slot_of(ref);
+        return slot == NIL_SLOT ? nullptr : &_arenas[slot];
+    }
+
+    const GenArenaRaw<Config>* resolve(Ref ref) const {
+        uint32_t slot = slot_of(ref);
+        return slot == NIL_SLOT ? nullptr : &_arenas[slot];
+    }
+
+    template <class T>
+    uint32_t size() const { return raw<T>().size(); }
+
+    template <class T, class... Args>
+    std::pair<TypedRef<T>, T*> emplace(Args&& ... args) {
+        TypedRef<T> ref;
+        void* ptr;
+        GenArenaResult res = raw<T>().insert_empty(ptr, ref);
+        if (res == GenArenaResult::Ok) {
+            new(ptr) T(std::forward<Args>(args)...);
+        } else {
+            if (res == GenArenaResult::OutOfMemory) {
+                gen_arena_log("GenArenaRegistry error in emplace(...): out of memory! (size = %d, capacity = %d)",
+                              raw<T>().size(), raw<T>().capacity());
+            } else {
+                gen_arena_log("GenArenaRegistry error in emplace(...): unknown");
+            }
+            ref.set(0, gen_arena_type_id<T>(), 0);
+            ptr = nullptr;
+        }
+        return {ref, static_cast<T*>(ptr)};
+    }
+
+    void release(Ref ref) {
+        static void (* const deleters[])(void*) = {&destroy_item<Types>...};
+
+        uint32_t slot = slot_of(ref);
+        GenArenaResult res = slot == NIL_SLOT ?
+                             GenArenaResult::RefInvalid :
+                             _arenas[slot].release_with_deleter(ref, deleters[slot]);
+
+        if (res != GenArenaResult::Ok) {
+            if (res == GenArenaResult::RefInvalid) {
+                gen_arena_log("GenArenaRegistry error in release(Ref): ref invalid! (index = %d, type_id = %d, generation = %d)",
+                              (uint32_t) ref.index(), (uint32_t) ref.type_id(), (uint32_t) ref.generation());
+            } else {
+                gen_arena_log("GenArenaRegistry error in release(Ref): unknown");
+            }
+        }
+    }
+
+    bool is_valid_ref(Ref ref) const {
+        const GenArenaRaw<Config>* raw = resolve(ref);
+        return raw != nullptr && raw->is_valid_ref(ref);
+    }
+
+    template <class T>
+    const T* get(TypedRef<T> ref) const {
+        return static_cast<const T*>(raw<T>().get(ref));
+    }
+
+    template <class T>
+    T* get(TypedRef<T> ref) {
+        return static_cast<T*>(raw<T>().get(ref));
+    }
+
+    template <class T>
+    const T* try_get(Ref ref) const {
+        if (ref.type_id() != gen_arena_type_id<T>()) return nullptr;
+        const GenArenaRaw<Config>& arena = raw<T>();
+        return arena.is_valid_ref(ref) ? static_cast<const T*>(arena.get(ref)) : nullptr;
+    }
+
+    template <class T>
+    T* try_get(Ref ref) {
+        if (ref.type_id() != gen_arena_type_id<T>()) return nullptr;
+        GenArenaRaw<Config>& arena = raw<T>();
+        return arena.is_valid_ref(ref) ? static_cast<T*>(arena.get(ref)) : nullptr;
+    }
+
+    // Calls fun(T&) with the item's static type (so fun will typically be an overloaded functor).
+    // Returns false without calling fun if the ref is invalid.
+    template <class Fun>
+    bool visit(Ref ref, Fun&& fun) {
+        using Thunk = void (*)(void*, Fun&);
+        static constexpr Thunk table[] = {&visit_item<Types, Fun>...};
+
+        uint32_t slot = slot_of(ref);
+        if (slot == NIL_SLOT || !_arenas[slot].is_valid_ref(ref)) return false;
+        table[slot](_arenas[slot].get(ref), fun);
+        return true;
+    }
+
+    template <class T, class Fun>
+    void foreach_val(Fun&& fun) {
+        GEN_ARENA_TRACE_SCOPE("GenArenaRegistry::foreach_val");
+        GenArenaRaw<Config>& arena = raw<T>();
+        T* items = static_cast<T*>(arena.item_buf());
+        for (uint32_t i = 0; i < arena.size(); i++) {
+            fun(items[i]);
+        }
+    }
+};
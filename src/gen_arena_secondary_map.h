@@ -0,0 +1,397 @@
+#pragma once
+
+/**
+ * Secondary maps, which attach optional data to the refs of a primary arena (or a GenHandleAllocator).
+ * Both are indexed directly by ref.index() and check the full ref (including the generation) on lookup,
+ * so stale refs read as missing entries, and entries of a stale ref are replaced when the slot is reused.
+ *
+ * - GenSecondaryMap<V> stores the values in a sparse array, so a lookup is a single array access.
+ *   Use this when most refs of the primary arena have an entry.
+ * - GenDenseSecondaryMap<V> keeps the values packed in a dense array (with swap-remove),
+ *   so iteration is cache-friendly and memory is proportional to the number of entries (plus 4 bytes per sparse slot).
+ *   Use this when only a few refs have an entry.
+ */
+
+#include <new> // needed for placement new
+#include <utility> // needed for std::forward and std::move
+
+#include <gen_arena_raw.h>
+
+template <class V, class Config = GenArenaDefaultConfig>
+class GenSecondaryMap {
+public:
+    using Ref = GenArenaRef<Config>;
+
+private:
+    // Marks empty slots (no valid ref has this index, since it's reserved as the free list terminator)
+    static constexpr uint32_t NIL = Ref::INDEX_MASK;
+
+    struct Slot {
+        Ref key;
+        alignas(V) unsigned char storage[sizeof(V)];
+
+        V* value() { return reinterpret_cast<V*>(storage); }
+    };
+
+    Slot* _slots;
+    uint32_t _capacity;
+    uint32_t _size;
+
+    bool reserve_index(uint32_t index) {
+        if (index < _capacity) return true;
+        if (index >= NIL) return false;
+
+        uint32_t new_capacity = _capacity == 0 ? 1 : _capacity;
+        while (new_capacity <= index) {
+            new_capacity = new_capacity > NIL / 2 ? NIL : 2 * new_capacity;
+        }
+
+        Slot* new_slots = gen_arena_new_array<Slot>(new_capacity);
+        if (new_slots == nullptr) return false;
+
+        // Unlike GenArenaRaw, values are relocated with move constructors (so that types like std::string work)
+        for (uint32_t i = 0; i < _capacity; i++) {
+            new_slots[i].key = _slots[i].key;
+            if (_slots[i].key.index() != NIL) {
+                new(new_slots[i].storage) V(std::move(*_slots[i].value()));
+                _slots[i].value()->~V();
+            }
+        }
+        for (uint32_t i = _capacity; i < new_capacity; i++) {
+            new_slots[i].key = Ref::make(NIL, 0, 0);
+        }
+        gen_arena_delete_array(_slots);
+
+        _slots = new_slots;
+        _capacity = new_capacity;
+        return true;
+    }
+
+    // Inserts or replaces the value of a ref whose index is below _capacity.
+    template <class... Args>
+    V* emplace_in_capacity(Ref ref, Args&& ... args) {
+        Slot& slot = _slots[ref.index()];
+        if (slot.key.index() != NIL) {
+            // The args might refer to the old value, so it's only replaced once the new one is constructed
+            *slot.value() = V(std::forward<Args>(args)...);
+            slot.key = ref;
+            return slot.value();
+        }
+        V* value = new(slot.storage) V(std::forward<Args>(args)...);
+        slot.key = ref;
+        _size++;
+        return value;
+    }
+
+public:
+    GenSecondaryMap() noexcept : _slots(nullptr), _capacity(0), _size(0) {}
+
+    ~GenSecondaryMap() noexcept {
+        release();
+    }
+
+    GenSecondaryMap(const GenSecondaryMap& other) = delete;
+
+    GenSecondaryMap& operator=(const GenSecondaryMap& other) = delete;
+
+    GenSecondaryMap(GenSecondaryMap&& other) noexcept : _slots(other._slots), _capacity(other._capacity), _size(other._size) {
+        other._slots = nullptr;
+        other._capacity = 0;
+        other._size = 0;
+    }
+
+    GenSecondaryMap& operator=(GenSecondaryMap&& other) noexcept {
+        std::swap(_slots, other._slots);
+        std::swap(_capacity, other._capacity);
+        std::swap(_size, other._size);
+        return *this;
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < _capacity; i++) {
+            if (_slots[i].key.index() != NIL) {
+                _slots[i].value()->~V();
+                _slots[i].key = Ref::make(NIL, 0, 0);
+            }
+        }
+        _size = 0;
+    }
+
+    void release() {
+        clear();
+        gen_arena_delete_array(_slots);
+        _slots = nullptr;
+        _capacity = 0;
+    }
+
+    uint32_t size() const { return _size; }
+
+    uint32_t capacity() const { return _capacity; }
+
+    // Inserts (or replaces) the value of the ref. Returns nullptr if out of memory.
+    // The args can refer to values of the map (including the one being replaced).
+    template <class... Args>
+    V* emplace(Ref ref, Args&& ... args) {
+        if (ref.index() < _capacity) return emplace_in_capacity(ref, std::forward<Args>(args)...);
+
+        // Growing moves the values, so the new value is constructed before that
+        V value(std::forward<Args>(args)...);
+        if (!reserve_index(ref.index())) {
+            gen_arena_log("GenSecondaryMap error in emplace(...): out of memory! (index = %d)", ref.index());
+            return nullptr;
+        }
+        return emplace_in_capacity(ref, std::move(value));
+    }
+
+    V* insert(Ref ref, const V& value) { return emplace(ref, value); }
+
+    V* insert(Ref ref, V&& value) { return emplace(ref, std::move(value)); }
+
+    bool remove(Ref ref) {
+        if (!contains(ref)) return false;
+
+        Slot& slot = _slots[ref.index()];
+        slot.value()->~V();
+        slot.key = Ref::make(NIL, 0, 0);
+        _size--;
+        return true;
+    }
+
+    bool contains(Ref ref) const {
+        return ref.index() < _capacity && _slots[ref.index()].key == ref;
+    }
+
+    const V* try_get(Ref ref) const {
+        return const_cast<GenSecondaryMap*>(this)->try_get(ref);
+    }
+
+    V* try_get(Ref ref) {
+        if (ref.index() >= _capacity) return nullptr;
+        Slot& slot = _slots[ref.index()];
+        return slot.key == ref ? slot.value() : nullptr;
+    }
+
+    template <class Fun>
+    void foreach_ref_val(Fun&& fun) {
+        for (uint32_t i = 0; i < _capacity; i++) {
+            if (_slots[i].key.index() != NIL) {
+                fun(_slots[i].key, *_slots[i].value());
+            }
+        }
+    }
+};
+
+template <class V, class Config = GenArenaDefaultConfig>
+class GenDenseSecondaryMap {
+public:
+    using Ref = GenArenaRef<Config>;
+
+private:
+    static constexpr uint32_t NIL = Ref::INDEX_MASK;
+
+    // Sparse array: ref.index() -> dense index (NIL if there is no entry)
+    uint32_t* _sparse;
+    uint32_t _sparse_capacity;
+
+    // Dense arrays of keys and values
+    Ref* _keys;
+    V* _values;
+    uint32_t _size;
+    uint32_t _capacity;
+
+    bool reserve_index(uint32_t index) {
+        if (index < _sparse_capacity) return true;
+        if (index >= NIL) return false;
+
+        uint32_t new_capacity = _sparse_capacity == 0 ? 1 : _sparse_capacity;
+        while (new_capacity <= index) {
+            new_capacity = new_capacity > NIL / 2 ? NIL : 2 * new_capacity;
+        }
+
+        uint32_t* new_sparse = gen_arena_new_array<uint32_t>(new_capacity);
+        if (new_sparse == nullptr) return false;
+
+        if (_sparse != nullptr) {
+            memcpy(new_sparse, _sparse, sizeof(uint32_t) * _sparse_capacity);
+            gen_arena_delete_array(_sparse);
+        }
+        for (uint32_t i = _sparse_capacity; i < new_capacity; i++) {
+            new_sparse[i] = NIL;
+        }
+
+        _sparse = new_sparse;
+        _sparse_capacity = new_capacity;
+        return true;
+    }
+
+    bool reserve_dense(uint32_t new_capacity) {
+        if (new_capacity <= _capacity) return true;
+
+        Ref* new_keys = gen_arena_new_array<Ref>(new_capacity);
+        if (new_keys == nullptr) return false;
+        V* new_values = gen_arena_new_array<V>(new_capacity);
+        if (new_values == nullptr) {
+            gen_arena_delete_array(new_keys);
+            return false;
+        }
+
+        for (uint32_t i = 0; i < _size; i++) {
+            new_keys[i] = _keys[i];
+            new(&new_values[i]) V(std::move(_values[i]));
+            _values[i].~V();
+        }
+        gen_arena_delete_array(_keys);
+        gen_arena_delete_array(_values);
+
+        _keys = new_keys;
+        _values = new_values;
+        _capacity = new_capacity;
+        return true;
+    }
+
+    // Appends an entry (the dense arrays should have room for it).
+    template <class... Args>
+    V* push(Ref ref, Args&& ... args) {
+        uint32_t dense_index = _size;
+        V* value = new(&_values[dense_index]) V(std::forward<Args>(args)...);
+        _keys[dense_index] = ref;
+        _sparse[ref.index()] = dense_index;
+        _size++;
+        return value;
+    }
+
+public:
+    GenDenseSecondaryMap() noexcept
+            : _sparse(nullptr), _sparse_capacity(0), _keys(nullptr), _values(nullptr), _size(0), _capacity(0) {}
+
+    ~GenDenseSecondaryMap() noexcept {
+        release();
+    }
+
+    GenDenseSecondaryMap(const GenDenseSecondaryMap& other) = delete;
+
+    GenDenseSecondaryMap& operator=(const GenDenseSecondaryMap& other) = delete;
+
+    GenDenseSecondaryMap(GenDenseSecondaryMap&& other) noexcept
+            : _sparse(other._sparse), _sparse_capacity(other._sparse_capacity),
+              _keys(other._keys), _values(other._values), _size(other._size), _capacity(other._capacity) {
+        other._sparse = nullptr;
+        other._sparse_capacity = 0;
+        other._keys = nullptr;
+        other._values = nullptr;
+        other._size = 0;
+        other._capacity = 0;
+    }
+
+    GenDenseSecondaryMap& operator=(GenDenseSecondaryMap&& other) noexcept {
+        std::swap(_sparse, other._sparse);
+        std::swap(_sparse_capacity, other._sparse_capacity);
+        std::swap(_keys, other._keys);
+        std::swap(_values, other._values);
+        std::swap(_size, other._size);
+        std::swap(_capacity, other._capacity);
+        return *this;
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < _size; i++) {
+            _sparse[_keys[i].index()] = NIL;
+            _values[i].~V();
+        }
+        _size = 0;
+    }
+
+    void release() {
+        clear();
+        gen_arena_delete_array(_sparse);
+        gen_arena_delete_array(_keys);
+        gen_arena_delete_array(_values);
+        _sparse = nullptr;
+        _sparse_capacity = 0;
+        _keys = nullptr;
+        _values = nullptr;
+        _capacity = 0;
+    }
+
+    uint32_t size() const { return _size; }
+
+    uint32_t capacity() const { return _capacity; }
+
+    const Ref* key_buf() const { return _keys; }
+
+    const V* value_buf() const { return _values; }
+
+    V* value_buf() { return _values; }
+
+    // Inserts (or replaces) the value of the ref. Returns nullptr if out of memory.
+    // The args can refer to values of the map (including the one being replaced).
+    template <class... Args>
+    V* emplace(Ref ref, Args&& ... args) {
+        if (!reserve_index(ref.index())) {
+            gen_arena_log("GenDenseSecondaryMap error in emplace(...): out of memory! (index = %d)", ref.index());
+            return nullptr;
+        }
+
+        uint32_t dense_index = _sparse[ref.index()];
+        if (dense_index != NIL) {
+            // Replace the entry (which might belong to a stale ref of the same slot).
+            // The args might refer to the old value, so it's only replaced once the new one is constructed.
+            _values[dense_index] = V(std::forward<Args>(args)...);
+            _keys[dense_index] = ref;
+            return &_values[dense_index];
+        }
+        if (_size == _capacity) {
+            // Growing moves the values, so the new value is constructed before that
+            V value(std::forward<Args>(args)...);
+            if (!reserve_dense(_capacity == 0 ? 1 : 2 * _capacity)) {
+                gen_arena_log("GenDenseSecondaryMap error in emplace(...): out of memory! (size = %d)", _size);
+                return nullptr;
+            }
+            return push(ref, std::move(value));
+        }
+        return push(ref, std::forward<Args>(args)...);
+    }
+
+    V* insert(Ref ref, const V& value) { return emplace(ref, value); }
+
+    V* insert(Ref ref, V&& value) { return emplace(ref, std::move(value)); }
+
+    bool remove(Ref ref) {
+        if (!contains(ref)) return false;
+
+        uint32_t dense_index = _sparse[ref.index()];
+        _sparse[ref.index()] = NIL;
+
+        // Remove-swap the last entry into the hole
+        uint32_t last = _size - 1;
+        if (dense_index != last) {
+            _values[dense_index] = std::move(_values[last]);
+            _keys[dense_index] = _keys[last];
+            _sparse[_keys[dense_index].index()] = dense_index;
+        }
+        _values[last].~V();
+        _size--;
+        return true;
+    }
+
+    bool contains(Ref ref) const {
+        if (ref.index() >= _sparse_capacity) return false;
+        uint32_t dense_index = _sparse[ref.index()];
+        return dense_index != NIL && _keys[dense_index] == ref;
+    }
+
+    const V* try_get(Ref ref) const {
+        return const_cast<GenDenseSecondaryMap*>(this)->try_get(ref);
+    }
+
+    V* try_get(Ref ref) {
+        return contains(ref) ? &_values[_sparse[ref.index()]] : nullptr;
+    }
+
+    template <class Fun>
+    void foreach_ref_val(Fun&& fun) {
+        for (uint32_t i = 0; i < _size; i++) {
+            fun(_keys[i], _values[i]);
+        }
+    }
+};
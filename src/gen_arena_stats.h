@@ -0,0 +1,74 @@
+#pragma once
+
+/**
+ * Text and JSON dumps of GenArenaStats (the counters of an arena, see GEN_ARENA_ENABLE_STATS and GenArenaRaw::stats())
+ * and of GenArenaMemoryReport (see GenArenaRaw::memory_report()).
+ * These write into the given buffer like snprintf(), and return the length that the full output needs (or a negative number on errors).
+ */
+
+#include <stdio.h>
+
+#include "gen_arena_raw.h"
+
+inline int gen_arena_stats_to_text(const GenArenaStats& stats, const char* name, char* buf, size_t buf_size) {
+    return snprintf(buf, buf_size,
+                    "%s: size %u (peak %u), capacity %u, free list %u / %u (%u retired)\n"
+                    "  inserts %llu, releases %llu, invalid ref lookups %llu\n"
+                    "  resizes %llu (%llu bytes copied), shrinks %llu, trims %llu%s\n",
+                    name, stats.size, stats.peak_size, stats.capacity, stats.free_list_length, stats.free_list_size, stats.retired_slots,
+                    (unsigned long long) stats.inserts, (unsigned long long) stats.releases,
+                    (unsigned long long) stats.invalid_ref_lookups, (unsigned long long) stats.resizes,
+                    (unsigned long long) stats.resize_bytes_copied, (unsigned long long) stats.shrinks,
+                    (unsigned long long) stats.trims, stats.enabled ? "" : " (counters disabled)");
+}
+
+// The name is written as is, so it shouldn't contain any characters that need escaping.
+inline int gen_arena_stats_to_json(const GenArenaStats& stats, const char* name, char* buf, size_t buf_size) {
+    return snprintf(buf, buf_size,
+                    "{\"name\":\"%s\",\"enabled\":%s,\"size\":%u,\"peak_size\":%u,\"capacity\":%u,"
+                    "\"free_list_size\":%u,\"free_list_length\":%u,\"retired_slots\":%u,\"inserts\":%llu,\"releases\":%llu,"
+                    "\"invalid_ref_lookups\":%llu,\"resizes\":%llu,\"resize_bytes_copied\":%llu,\"shrinks\":%llu,\"trims\":%llu}",
+                    name, stats.enabled ? "true" : "false", stats.size, stats.peak_size, stats.capacity,
+                    stats.free_list_size, stats.free_list_length, stats.retired_slots, (unsigned long long) stats.inserts,
+                    (unsigned long long) stats.releases, (unsigned long long) stats.invalid_ref_lookups,
+                    (unsigned long long) stats.resizes, (unsigned long long) stats.resize_bytes_copied,
+                    (unsigned long long) stats.shrinks, (unsigned long long) stats.trims);
+}
+
+inline int gen_arena_memory_report_to_text(const GenArenaMemoryReport& report, const char* name, char* buf, size_t buf_size) {
+    return snprintf(buf, buf_size,
+                    "%s: %llu / %llu bytes used (items %llu / %llu, metadata %llu / %llu, sparse %llu / %llu)\n"
+                    "  live ratio %.3f, sparse to dense ratio %.3f, locality %.3f\n",
+                    name, (unsigned long long) report.total_bytes_used, (unsigned long long) report.total_bytes_reserved,
+                    (unsigned long long) report.item_bytes_used, (unsigned long long) report.item_bytes_reserved,
+                    (unsigned long long) report.metadata_bytes_used, (unsigned long long) report.metadata_bytes_reserved,
+                    (unsigned long long) report.sparse_bytes_used, (unsigned long long) report.sparse_bytes_reserved,
+                    report.live_ratio, report.sparse_to_dense_ratio, report.locality);
+}
+
+#ifdef GEN_ARENA_ENABLE_MEMORY_REGISTRY
+
+// Writes the memory report of every registered arena (see GEN_ARENA_ENABLE_MEMORY_REGISTRY), followed by the totals.
+// Unnamed arenas are listed by address. The arenas shouldn't be modified by other threads meanwhile.
+inline void gen_arena_memory_registry_dump(FILE* file) {
+    size_t total_reserved = 0;
+    size_t total_used = 0;
+    uint32_t count = 0;
+    GenArenaMemoryRegistry::instance().foreach([&](const void* arena, const GenArenaMemoryRegistry::Entry& entry) {
+        GenArenaMemoryReport report;
+        entry.report(arena, report);
+        total_reserved += report.total_bytes_reserved;
+        total_used += report.total_bytes_used;
+        count++;
+
+        char name[32];
+        if (entry.name == nullptr) snprintf(name, sizeof(name), "arena %p", arena);
+        char buf[512];
+        gen_arena_memory_report_to_text(report, entry.name != nullptr ? entry.name : name, buf, sizeof(buf));
+        fputs(buf, file);
+    });
+    fprintf(file, "total: %u arenas, %llu / %llu bytes used\n", count,
+            (unsigned long long) total_used, (unsigned long long) total_reserved);
+}
+
+#endif
@@ -0,0 +1,177 @@
+#pragma once
+
+/**
+ * Expiry (TTL) for the items of a GenArena, with a hierarchical timing wheel of refs.
+ * Scheduling, rescheduling and cancelling are O(1), and advance(now) only touches the entries that are due
+ * (plus the ones that cascade down from the coarser levels), instead of scanning the whole arena.
+ * Each level keeps a bitmap of its non-empty slots, so advance() jumps straight to the next slot that comes up
+ * instead of stepping through every tick in between.
+ *
+ * Time is measured in ticks of whatever unit the user picks (milliseconds, frames, ...).
+ * The deadline of each ref is also kept in a GenSecondaryMap, so wheel entries that were rescheduled or cancelled
+ * (or whose item was released in the meantime, which the generation check catches) are just dropped when they come up.
+ */
+
+#include <vector>
+
+#include <gen_arena.h>
+#include <gen_arena_secondary_map.h>
+
+template <class T, class Config = GenArenaDefaultConfig>
+class GenArenaTimerWheel {
+public:
+    using Ref = GenArenaTypedRef<T, Config>;
+
+private:
+    // Each level has 64 slots, and each slot of a level spans all 64 slots of the level below it.
+    // So the 4 levels cover 2^24 ticks ahead, and entries that are even further away wait in the last level (and are re-inserted from there).
+    static constexpr uint32_t LEVEL_BITS = 6;
+    static constexpr uint32_t SLOT_COUNT = 1u << LEVEL_BITS;
+    static constexpr uint32_t SLOT_MASK = SLOT_COUNT - 1;
+    static constexpr uint32_t LEVEL_COUNT = 4;
+
+    struct Entry {
+        Ref ref;
+        uint64_t expiry;
+    };
+
+    GenArena<T, Config>& _arena;
+    GenSecondaryMap<uint64_t, Config> _deadlines;
+
+    std::vector<Entry> _slots[LEVEL_COUNT][SLOT_COUNT];
+    // Bit i is set when _slots[level][i] isn't empty
+    uint64_t _occupied[LEVEL_COUNT];
+    // Entries that were already due when they were scheduled
+    std::vector<Entry> _due;
+
+    uint64_t _now;
+
+    std::vector<Ref> _batch;
+
+    void insert(const Entry& entry) {
+        if (entry.expiry <= _now) {
+            _due.push_back(entry);
+            return;
+        }
+        // Find the finest level where the expiry shares the upper bits with the current tick
+        for (uint32_t level = 0; level < LEVEL_COUNT; level++) {
+            uint32_t shift = LEVEL_BITS * (level + 1);
+            if ((entry.expiry >> shift) == (_now >> shift)) {
+                uint32_t slot = (entry.expiry >> (LEVEL_BITS * level)) & SLOT_MASK;
+                _slots[level][slot].push_back(entry);
+                _occupied[level] |= 1ull << slot;
+                return;
+            }
+        }
+        // Too far ahead: put it in the first slot of the last level, which comes up (and re-inserts it) when the last level wraps around
+        _slots[LEVEL_COUNT - 1][0].push_back(entry);
+        _occupied[LEVEL_COUNT - 1] |= 1;
+    }
+
+    // Moves the entries of a slot down to the finer levels (or to the due list).
+    void cascade(uint32_t level, uint32_t slot) {
+        std::vector<Entry> entries;
+        entries.swap(_slots[level][slot]);
+        _occupied[level] &= ~(1ull << slot);
+        for (const Entry& entry : entries) {
+            insert(entry);
+        }
+    }
+
+    void collect(std::vector<Entry>& entries) {
+        for (const Entry& entry : entries) {
+            // Drop entries that were rescheduled or cancelled, or whose item is gone
+            uint64_t* deadline = _deadlines.try_get(entry.ref);
+            if (deadline != nullptr && *deadline == entry.expiry) {
+                _deadlines.remove(entry.ref);
+                _batch.push_back(entry.ref);
+            }
+        }
+        entries.clear();
+    }
+
+    // Returns the next tick where a slot of the wheel comes up (to expire or to cascade), or UINT64_MAX if the wheel is empty.
+    uint64_t next_tick() const {
+        uint64_t next = UINT64_MAX;
+        for (uint32_t level = 0; level < LEVEL_COUNT; level++) {
+            uint32_t shift = LEVEL_BITS * level;
+            uint64_t rotation = _now >> (shift + LEVEL_BITS);
+            // The entries of a level are always in the slots after the current one, since insert() puts them
+            // in the finest level where they fit (and the current slot of each level has already cascaded)
+            uint32_t current = (_now >> shift) & SLOT_MASK;
+            uint64_t later = _occupied[level] & ~((2ull << current) - 1);
+            if (later != 0) {
+                uint64_t tick = ((rotation << LEVEL_BITS) | (uint64_t) gen_arena_ctz64(later)) << shift;
+                if (tick < next) next = tick;
+            }
+            // Except for the entries that are too far ahead, which wait in the first slot of the last level until it wraps around
+            if (level == LEVEL_COUNT - 1 && (_occupied[level] & 1) != 0) {
+                uint64_t tick = (rotation + 1) << (shift + LEVEL_BITS);
+                if (tick < next) next = tick;
+            }
+        }
+        return next;
+    }
+
+public:
+    explicit GenArenaTimerWheel(GenArena<T, Config>& arena, uint64_t now = 0)
+            : _arena(arena), _occupied(), _now(now) {}
+
+    GenArenaTimerWheel(const GenArenaTimerWheel& other) = delete;
+
+    GenArenaTimerWheel& operator=(const GenArenaTimerWheel& other) = delete;
+
+    uint64_t now() const { return _now; }
+
+    // Number of scheduled refs
+    uint32_t size() const { return _deadlines.size(); }
+
+    // Schedules the item of the ref to be released at the given tick (replacing its previous deadline, if any).
+    void schedule(Ref ref, uint64_t expiry) {
+        _deadlines.insert(ref, expiry);
+        insert(Entry{ref, expiry});
+    }
+
+    void schedule_after(Ref ref, uint64_t ttl) {
+        schedule(ref, _now + ttl);
+    }
+
+    // Returns false if the ref wasn't scheduled. (Its wheel entry is dropped lazily, when its slot comes up.)
+    bool cancel(Ref ref) {
+        return _deadlines.remove(ref);
+    }
+
+    const uint64_t* deadline(Ref ref) const {
+        return _deadlines.try_get(ref);
+    }
+
+    // Moves the clock forward, and releases the items that expired up to now (in one batch).
+    // Returns the number of released items.
+    uint32_t advance(uint64_t now) {
+        _batch.clear();
+        collect(_due);
+
+        while (_now < now) {
+            uint64_t next = next_tick();
+            if (next > now) {
+                // Nothing to expire or cascade until then, so skip ahead
+                _now = now;
+                break;
+            }
+            _now = next;
+
+            // Cascade the coarser levels whose slot just came up (from the top, since those can land in the lower levels)
+            uint32_t level = 1;
+            while (level < LEVEL_COUNT && (_now & ((1ull << (LEVEL_BITS * level)) - 1)) == 0) level++;
+            for (uint32_t l = level - 1; l >= 1; l--) {
+                cascade(l, (_now >> (LEVEL_BITS * l)) & SLOT_MASK);
+            }
+
+            collect(_slots[0][_now & SLOT_MASK]);
+            _occupied[0] &= ~(1ull << (_now & SLOT_MASK));
+            collect(_due);
+        }
+
+        return _arena.release_batch(_batch.data(), (uint32_t) _batch.size());
+    }
+};
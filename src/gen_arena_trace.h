@@ -0,0 +1,126 @@
+#pragma once
+
+/**
+ * The built-in backend for the trace hooks of the library (see GEN_ARENA_ENABLE_TRACE in gen_arena_config.h).
+ * Each thread records the spans of the traced operations (resize, shrink, batch operations, foreach loops, ...)
+ * into its own fixed-size ring buffer, without any locks. gen_arena_trace_write_json() then writes the recorded spans
+ * as a Chrome trace-event file, which can be opened with chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Ring buffers are never freed (so that they can be dumped after their threads have exited),
+ * and each one keeps only the last GEN_ARENA_TRACE_CAPACITY spans of its thread.
+ * Dumping while other threads are still tracing is allowed, but the spans they record in the meantime might come out garbled.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+
+#ifndef GEN_ARENA_TRACE_CAPACITY
+#define GEN_ARENA_TRACE_CAPACITY 4096
+#endif
+
+struct GenArenaTraceEvent {
+    const char* name; // Should be a string literal (only the pointer is stored)
+    uint64_t begin_ns;
+    uint64_t duration_ns;
+};
+
+struct GenArenaTraceBuffer {
+    GenArenaTraceEvent events[GEN_ARENA_TRACE_CAPACITY];
+    // Total number of events ever recorded (the ring buffer index is this modulo the capacity)
+    std::atomic<uint64_t> count;
+    uint32_t thread_id;
+    GenArenaTraceBuffer* next;
+};
+
+// Head of the (append-only) list of all ring buffers
+inline std::atomic<GenArenaTraceBuffer*>& gen_arena_trace_buffers() {
+    static std::atomic<GenArenaTraceBuffer*> head(nullptr);
+    return head;
+}
+
+inline uint64_t gen_arena_trace_now_ns() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The ring buffer of the calling thread (created on first use).
+inline GenArenaTraceBuffer* gen_arena_trace_thread_buffer() {
+    static std::atomic<uint32_t> next_thread_id(1);
+    static thread_local GenArenaTraceBuffer* buffer = nullptr;
+    if (buffer == nullptr) {
+        buffer = new GenArenaTraceBuffer();
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->thread_id = next_thread_id.fetch_add(1, std::memory_order_relaxed);
+
+        std::atomic<GenArenaTraceBuffer*>& head = gen_arena_trace_buffers();
+        buffer->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+    return buffer;
+}
+
+inline void gen_arena_trace_record(const char* name, uint64_t begin_ns, uint64_t end_ns) {
+    GenArenaTraceBuffer* buffer = gen_arena_trace_thread_buffer();
+    uint64_t count = buffer->count.load(std::memory_order_relaxed);
+    GenArenaTraceEvent& event = buffer->events[count % GEN_ARENA_TRACE_CAPACITY];
+    event.name = name;
+    event.begin_ns = begin_ns;
+    event.duration_ns = end_ns - begin_ns;
+    // Publish the event to the dumping thread
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+// Records the span of its own lifetime (this is what GEN_ARENA_TRACE_SCOPE() expands to).
+class GenArenaTraceScope {
+private:
+    const char* _name;
+    uint64_t _begin_ns;
+
+public:
+    explicit GenArenaTraceScope(const char* name) : _name(name), _begin_ns(gen_arena_trace_now_ns()) {}
+
+    ~GenArenaTraceScope() {
+        gen_arena_trace_record(_name, _begin_ns, gen_arena_trace_now_ns());
+    }
+
+    GenArenaTraceScope(const GenArenaTraceScope& other) = delete;
+
+    GenArenaTraceScope& operator=(const GenArenaTraceScope& other) = delete;
+};
+
+// Drops the recorded events of all threads (which shouldn't be tracing at the same time).
+inline void gen_arena_trace_clear() {
+    for (GenArenaTraceBuffer* buffer = gen_arena_trace_buffers().load(std::memory_order_acquire);
+         buffer != nullptr; buffer = buffer->next) {
+        buffer->count.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Writes the recorded events of all threads as a Chrome trace-event JSON file. Returns false if the file couldn't be written.
+inline bool gen_arena_trace_write_json(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) return false;
+
+    fprintf(file, "{\"traceEvents\":[");
+    bool first = true;
+    for (GenArenaTraceBuffer* buffer = gen_arena_trace_buffers().load(std::memory_order_acquire);
+         buffer != nullptr; buffer = buffer->next) {
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t begin = count > GEN_ARENA_TRACE_CAPACITY ? count - GEN_ARENA_TRACE_CAPACITY : 0;
+        for (uint64_t i = begin; i < count; i++) {
+            const GenArenaTraceEvent& event = buffer->events[i % GEN_ARENA_TRACE_CAPACITY];
+            // Timestamps are in microseconds
+            fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"gen_arena\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                    first ? "" : ",", event.name, event.begin_ns / 1000.0, event.duration_ns / 1000.0, buffer->thread_id);
+            first = false;
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    bool ok = ferror(file) == 0;
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,247 @@
+// Tests of the optional features that are compiled in by defines (see gen_arena_config.h).
+// These are in their own binary, so that test/main.cpp covers the default configuration.
+#define DOCTEST_CONFIG_NO_EXCEPTIONS_BUT_WITH_ALL_ASSERTS
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define GEN_ARENA_USE_TYPE_ID
+#define GEN_ARENA_ENABLE_STATS
+#define GEN_ARENA_ENABLE_TRACE
+#define GEN_ARENA_ENABLE_MEMORY_REGISTRY
+#define GEN_ARENA_ENABLE_BUDGET
+
+#include "doctest.h"
+
+#include <gen_arena.h>
+#include <gen_arena_handle.h>
+#include <gen_arena_registry.h>
+#include <gen_arena_stats.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Obj {
+    uint32_t a, b, c, d;
+
+    Obj() = default;
+
+    Obj(uint32_t v) : a(v), b(v), c(v), d(v) {}
+};
+
+template <>
+inline constexpr uint32_t gen_arena_type_id<Obj>() { return 1; }
+
+template <>
+inline constexpr uint32_t gen_arena_type_id<uint64_t>() { return 2; }
+
+TEST_CASE("gen_arena_type_id_test") {
+    GenArena<Obj> objs;
+    GenArena<uint64_t> values;
+    GenArenaRef<> obj_ref = objs.emplace(1u).first;
+    GenArenaRef<> value_ref = values.insert(2).first;
+    CHECK(obj_ref.type_id() == 1);
+    CHECK(value_ref.type_id() == 2);
+    CHECK(obj_ref.index() == value_ref.index());
+    CHECK(obj_ref.generation() == value_ref.generation());
+
+    // Refs of one type can't be used with the arena of another type
+    CHECK(objs.raw().is_valid_ref(obj_ref));
+    CHECK(!objs.raw().is_valid_ref(value_ref));
+    CHECK(objs.raw().try_get(value_ref) == nullptr);
+    CHECK(objs.raw().release(value_ref) == GenArenaResult::RefInvalid);
+    CHECK(objs.size() == 1);
+
+    // An arena that stores its items under the refs of a handle allocator takes the handles' type id,
+    // so the refs of its foreach loops are valid
+    GenHandleAllocator<> handles;
+    handles.setup(0, 3);
+    GenArena<Obj> shared;
+    for (uint32_t i = 0; i < 4; i++) {
+        GenArenaRef<> handle;
+        REQUIRE(handles.allocate(handle) == GenArenaResult::Ok);
+        REQUIRE(shared.emplace_at(handle, i) != nullptr);
+    }
+    uint32_t visited = 0;
+    shared.foreach_ref([&](GenArena<Obj>::Ref ref) {
+        CHECK(ref.type_id() == 3);
+        CHECK(shared.is_valid_ref(ref));
+        visited++;
+    });
+    shared.foreach_ref_val([&](GenArena<Obj>::Ref ref, Obj&) {
+        CHECK(shared.is_valid_ref(ref));
+        visited++;
+    });
+    shared.foreach_ref_val_in_group(0, [&](GenArena<Obj>::Ref ref, Obj&) {
+        CHECK(shared.is_valid_ref(ref));
+        visited++;
+    });
+    CHECK(visited == 12);
+    handles.release();
+}
+
+TEST_CASE("gen_arena_stats_test") {
+    GenArena<Obj> arena;
+    std::vector<GenArena<Obj>::Ref> refs;
+    for (uint32_t i = 0; i < 100; i++) {
+        refs.push_back(arena.emplace(i).first);
+    }
+    for (uint32_t i = 0; i < 60; i++) {
+        arena.release(refs[i]);
+    }
+    arena.release(refs[0]);
+    CHECK(arena.try_get(refs[1]) == nullptr);
+    CHECK(arena.try_get(refs[99]) != nullptr);
+    arena.shrink();
+
+    // Lookups from other threads are counted in their own shards
+    std::thread reader([&]() {
+        for (uint32_t i = 0; i < 10; i++) arena.try_get(refs[i]);
+    });
+    reader.join();
+
+    GenArenaStats stats = arena.stats();
+    CHECK(stats.enabled);
+    CHECK(stats.inserts == 100);
+    CHECK(stats.releases == 60);
+    CHECK(stats.invalid_ref_lookups == 12);
+    CHECK(stats.peak_size == 100);
+    CHECK(stats.size == 40);
+    CHECK(stats.capacity == 64);
+    CHECK(stats.resizes == 9); // Growing from 0 up to 128, and the shrink
+    CHECK(stats.shrinks == 1);
+    CHECK(stats.resize_bytes_copied > 0);
+    CHECK(stats.free_list_size == 100);
+    CHECK(stats.free_list_length == 60);
+
+    char buf[1024];
+    int len = gen_arena_stats_to_json(stats, "objs", buf, sizeof(buf));
+    REQUIRE((len > 0 && len < (int) sizeof(buf)));
+    CHECK(std::string(buf).find("\"inserts\":100,") != std::string::npos);
+    len = gen_arena_stats_to_text(stats, "objs", buf, sizeof(buf));
+    REQUIRE((len > 0 && len < (int) sizeof(buf)));
+    CHECK(std::string(buf).find("objs: size 40 (peak 100)") == 0);
+
+    // Failed resizes aren't counted
+    GenArenaBudget::instance().set_cap(GenArenaBudget::instance().used());
+    CHECK(arena.reserve_dense(1 << 20) == GenArenaResult::OutOfMemory);
+    GenArenaBudget::instance().set_cap(SIZE_MAX);
+    CHECK(arena.stats().resizes == 9);
+    CHECK(arena.stats().resize_bytes_copied == stats.resize_bytes_copied);
+
+    arena.reset_stats();
+    CHECK(arena.stats().inserts == 0);
+}
+
+TEST_CASE("gen_arena_memory_registry_test") {
+    size_t registered = GenArenaMemoryRegistry::instance().size();
+    {
+        GenArena<Obj> arena;
+        arena.set_name("objs");
+        CHECK(GenArenaMemoryRegistry::instance().size() == registered + 1);
+        for (uint32_t i = 0; i < 100; i++) {
+            arena.emplace(i);
+        }
+        GenArenaMemoryReport report = arena.memory_report();
+
+        bool found = false;
+        GenArenaMemoryRegistry::instance().foreach([&](const void* ptr, const GenArenaMemoryRegistry::Entry& entry) {
+            if (ptr != &arena.raw()) return;
+            found = true;
+            CHECK(std::string(entry.name) == "objs");
+            GenArenaMemoryReport registered_report;
+            entry.report(ptr, registered_report);
+            CHECK(registered_report.total_bytes_used == report.total_bytes_used);
+        });
+        CHECK(found);
+    }
+    CHECK(GenArenaMemoryRegistry::instance().size() == registered);
+}
+
+TEST_CASE("gen_arena_budget_test") {
+    GenArenaBudget& budget = GenArenaBudget::instance();
+    size_t baseline = budget.used();
+    {
+        // An idle arena that grew big, and then lost most of its items
+        GenArena<uint64_t> idle;
+        std::vector<GenArena<uint64_t>::Ref> refs;
+        for (uint64_t i = 0; i < 4096; i++) {
+            refs.push_back(idle.insert(i).first);
+        }
+        for (uint32_t i = 0; i < 4090; i++) {
+            idle.release(refs[i]);
+        }
+        size_t idle_bytes = budget.used() - baseline;
+        CHECK(idle_bytes >= 4096 * (sizeof(uint64_t) + sizeof(GenArenaMetadata) + sizeof(GenArena<uint64_t>::Ref)));
+
+        // Only the dense buffers (12 bytes per item) grow from here on
+        GenArena<uint64_t> arena;
+        CHECK(arena.reserve_sparse(1 << 16) == GenArenaResult::Ok);
+        budget.set_cap(budget.used() + 2000);
+        CHECK(arena.resize(64) == GenArenaResult::Ok);
+        CHECK(arena.resize(512) == GenArenaResult::OutOfMemory);
+        CHECK(arena.capacity() == 64);
+        uint32_t inserted = 0;
+        while (arena.insert(inserted).second != nullptr) inserted++;
+        CHECK(inserted == 128);
+
+        // Under pressure, the idle arena gets shrunk to make room
+        struct Pressure {
+            GenArena<uint64_t>* idle;
+            uint32_t calls;
+        } pressure = {&idle, 0};
+        auto on_pressure = [](void* ctx, size_t bytes_needed) {
+            Pressure* p = static_cast<Pressure*>(ctx);
+            CHECK(bytes_needed > 0);
+            p->calls++;
+            p->idle->shrink();
+        };
+        budget.add_pressure_callback(on_pressure, &pressure);
+        CHECK(arena.resize(512) == GenArenaResult::Ok);
+        CHECK(pressure.calls == 1);
+        CHECK(idle.capacity() == 8);
+        CHECK(arena.insert(7).second != nullptr);
+
+        // Nothing left to shrink
+        CHECK(arena.resize(1 << 16) == GenArenaResult::OutOfMemory);
+        CHECK(pressure.calls == 2);
+        budget.remove_pressure_callback(on_pressure, &pressure);
+        budget.set_cap(SIZE_MAX);
+    }
+    CHECK(budget.used() == baseline);
+}
+
+TEST_CASE("gen_arena_trace_test") {
+    gen_arena_trace_clear();
+
+    GenArena<Obj> arena;
+    std::vector<GenArena<Obj>::Ref> refs;
+    for (uint32_t i = 0; i < 100; i++) {
+        refs.push_back(arena.emplace(i).first);
+    }
+    arena.foreach_val([](Obj& obj) {});
+    CHECK(arena.release_batch(refs.data(), 50) == 50);
+
+    std::thread other([]() {
+        GenArena<Obj> other_arena;
+        other_arena.resize(10);
+    });
+    other.join();
+
+    const char* path = "gen_arena_trace_test.json";
+    REQUIRE(gen_arena_trace_write_json(path));
+    FILE* file = fopen(path, "r");
+    REQUIRE(file != nullptr);
+    std::string json;
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) json.append(buf, len);
+    fclose(file);
+    remove(path);
+
+    CHECK(json.find("{\"traceEvents\":[") == 0);
+    CHECK(json.find("\"name\":\"GenArenaRaw::resize\"") != std::string::npos);
+    CHECK(json.find("\"name\":\"GenArena::foreach_val\"") != std::string::npos);
+    CHECK(json.find("\"name\":\"GenArenaRaw::release_batch\"") != std::string::npos);
+    // The other thread's events are in there too
+    CHECK(json.find("\"tid\":1}") != std::string::npos);
+    CHECK(json.find("\"tid\":2}") != std::string::npos);
+}
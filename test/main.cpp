@@ -4,9 +4,21 @@
 #include "doctest.h"
 
 #include <gen_arena.h>
+#include <gen_arena_registry.h>
+#include <gen_arena_handle.h>
+#include <gen_arena_secondary_map.h>
+#include <gen_arena_query.h>
+#include <gen_arena_group.h>
+#include <gen_arena_fixed.h>
+#include <gen_arena_cache.h>
+#include <gen_arena_timer.h>
+#include <gen_arena_stats.h>
 
 #include <array>
+#include <atomic>
 #include <random>
+#include <string>
+#include <thread>
 
 struct Obj {
     uint32_t a, b, c, d;
@@ -190,3 +202,1219 @@ TEST_CASE("gen_arena_complex_test_2") {
         }
     }
 }
+
+TEST_CASE("gen_arena_group_test") {
+    using GroupConfig = GenArenaConfig<32, 8, 24, 3>;
+    const uint32_t test_size = 256;
+    GenArena<Obj, GroupConfig> arena;
+    arena.setup(4);
+    std::vector<GenArena<Obj, GroupConfig>::Ref> refs(test_size);
+    for (uint32_t i = 0; i < test_size; i++) {
+        Obj* ptr;
+        std::tie(refs[i], ptr) = arena.emplace(i);
+        CHECK(arena.get_group(refs[i]) == 0);
+    }
+
+    std::mt19937 rng(1234);
+    std::vector<uint32_t> groups(test_size, 0);
+    for (uint32_t iter = 0; iter < 4 * test_size; iter++) {
+        uint32_t i = rng() % test_size;
+        groups[i] = rng() % 3;
+        arena.set_group(refs[i], groups[i]);
+    }
+
+    // Release a few items, and insert some new ones (which should land in group 0)
+    for (uint32_t i = 0; i < test_size; i += 4) {
+        arena.release(refs[i]);
+        CHECK(!arena.is_valid_ref(refs[i]));
+        Obj* ptr;
+        std::tie(refs[i], ptr) = arena.emplace(i);
+        groups[i] = 0;
+    }
+
+    uint32_t counts[3] = {0, 0, 0};
+    for (uint32_t i = 0; i < test_size; i++) {
+        CHECK(*arena.get(refs[i]) == i);
+        CHECK(arena.get_group(refs[i]) == groups[i]);
+        counts[groups[i]]++;
+    }
+    for (uint32_t g = 0; g < 3; g++) {
+        CHECK(arena.group_size(g) == counts[g]);
+        uint32_t visited = 0;
+        arena.foreach_ref_val_in_group(g, [&](GenArena<Obj, GroupConfig>::Ref ref, Obj& value) {
+            CHECK(groups[value.a] == g);
+            CHECK(arena.get(ref) == &value);
+            visited++;
+        });
+        CHECK(visited == counts[g]);
+    }
+}
+
+struct Circle {
+    float radius;
+};
+
+struct Rect {
+    float width, height;
+};
+
+template <>
+inline constexpr uint32_t gen_arena_type_id<Circle>() { return 2; }
+
+template <>
+inline constexpr uint32_t gen_arena_type_id<Rect>() { return 3; }
+
+struct AreaVisitor {
+    float area = 0.0f;
+
+    void operator()(Circle& c) { area = 3.0f * c.radius * c.radius; }
+
+    void operator()(Rect& r) { area = r.width * r.height; }
+};
+
+TEST_CASE("gen_arena_registry_test") {
+    GenArenaRegistry<GenArenaDefaultConfig, Circle, Rect> registry;
+
+    std::vector<GenArenaRef<GenArenaDefaultConfig>> refs;
+    for (uint32_t i = 0; i < 16; i++) {
+        if (i % 2 == 0) {
+            refs.push_back(registry.emplace<Circle>(Circle{(float) i}).first);
+        } else {
+            refs.push_back(registry.emplace<Rect>(Rect{(float) i, 2.0f}).first);
+        }
+    }
+    CHECK(registry.size<Circle>() == 8);
+    CHECK(registry.size<Rect>() == 8);
+
+    for (uint32_t i = 0; i < 16; i++) {
+        CHECK(registry.is_valid_ref(refs[i]));
+        CHECK(registry.resolve(refs[i]) == (i % 2 == 0 ? &registry.raw<Circle>() : &registry.raw<Rect>()));
+        AreaVisitor visitor;
+        CHECK(registry.visit(refs[i], visitor));
+        CHECK(visitor.area == (i % 2 == 0 ? 3.0f * i * i : 2.0f * i));
+    }
+    CHECK(registry.try_get<Circle>(refs[0]) != nullptr);
+    CHECK(registry.try_get<Rect>(refs[0]) == nullptr);
+
+    registry.release(refs[2]);
+    registry.release(refs[3]);
+    CHECK(!registry.is_valid_ref(refs[2]));
+    CHECK(!registry.is_valid_ref(refs[3]));
+    AreaVisitor visitor;
+    CHECK(!registry.visit(refs[2], visitor));
+    CHECK(registry.size<Circle>() == 7);
+    CHECK(registry.size<Rect>() == 7);
+
+    float total = 0.0f;
+    registry.foreach_val<Rect>([&](Rect& r) { total += r.height; });
+    CHECK(total == 14.0f);
+
+    const auto& const_registry = registry;
+    CHECK(const_registry.try_get<Rect>(refs[1])->width == 1.0f);
+    CHECK(const_registry.try_get<Rect>(refs[3]) == nullptr);
+
+    // Releasing empties the registry, which can then be used again (and released again, by the destructor too)
+    registry.release();
+    CHECK(registry.size<Circle>() == 0);
+    CHECK(registry.size<Rect>() == 0);
+    CHECK(!registry.is_valid_ref(refs[0]));
+    registry.release();
+    auto circle = registry.emplace<Circle>(Circle{1.0f});
+    REQUIRE(circle.second != nullptr);
+    CHECK(registry.get(circle.first)->radius == 1.0f);
+}
+
+TEST_CASE("gen_arena_compact_ref_test") {
+    using SmallConfig = GenArenaConfig<20, 0, 12>;
+    using SmallRef = GenArenaRef<SmallConfig>;
+    static_assert(sizeof(SmallRef) == 4, "Small refs should fit in 32 bits");
+    static_assert(SmallRef::make(5, 0, 7).index() == 5, "Ref accessors should be constexpr");
+    static_assert(SmallRef::make(5, 0, 7).generation() == 7, "Ref accessors should be constexpr");
+    static_assert(sizeof(GenArenaRaw<GenArenaConfig<32, 0, 24>>) < sizeof(GenArenaRaw<GenArenaConfig<32, 8, 24, 4>>),
+                  "Unused type ids and groups shouldn't take any storage");
+
+    auto ref = GenArenaRef<>::make(123, 45, 678);
+    CHECK(ref.index() == 123);
+    CHECK(ref.type_id() == 45);
+    CHECK(ref.generation() == 678);
+    ref.set_generation(GenArenaRef<>::GENERATION_MASK + 1); // wraps around like a bitfield
+    CHECK(ref.generation() == 0);
+    CHECK(ref.index() == 123);
+    CHECK(ref.type_id() == 45);
+
+    std::atomic<SmallRef> shared(SmallRef::make(1, 0, 1));
+    SmallRef expected = SmallRef::make(1, 0, 1);
+    CHECK(shared.compare_exchange_strong(expected, SmallRef::make(2, 0, 3)));
+    CHECK(shared.load() == SmallRef::make(2, 0, 3));
+
+    // Churn a small arena until the 12 bit generations of its slots saturate (each slot is handed out 4095 times),
+    // after which the slots are retired instead of wrapping around
+    GenArena<Obj, SmallConfig> arena;
+    std::vector<GenArena<Obj, SmallConfig>::Ref> refs;
+    for (uint32_t i = 0; i < 64; i++) {
+        refs.push_back(arena.emplace(i).first);
+    }
+    const uint32_t iterations = 64 * SmallRef::GENERATION_MASK;
+    for (uint32_t iter = 0; iter < iterations; iter++) {
+        uint32_t i = iter % 64;
+        arena.release(refs[i]);
+        CHECK(!arena.is_valid_ref(refs[i]));
+        refs[i] = arena.emplace(iter).first;
+        CHECK(arena.get(refs[i])->a == iter);
+    }
+    CHECK(arena.size() == 64);
+    CHECK(arena.raw().stats().retired_slots == 64);
+    CHECK(arena.raw().free_list_size() == 128);
+    for (uint32_t i = 0; i < 64; i++) {
+        CHECK(refs[i].index() >= 64);
+    }
+}
+
+TEST_CASE("gen_arena_retired_slot_test") {
+    // 4 generation bits, so a slot can be handed out 15 times (generations 1 to 15)
+    using TinyConfig = GenArenaConfig<20, 0, 4>;
+    GenArena<Obj, TinyConfig> arena;
+    std::vector<GenArena<Obj, TinyConfig>::Ref> refs;
+    for (uint32_t iter = 0; iter < 100; iter++) {
+        refs.push_back(arena.emplace(iter).first);
+        arena.release(refs.back());
+    }
+    // None of the old refs may become valid again
+    auto live = arena.emplace(100u).first;
+    for (auto ref : refs) {
+        CHECK(!arena.is_valid_ref(ref));
+    }
+    CHECK(arena.is_valid_ref(live));
+
+    GenArenaStats stats = arena.raw().stats();
+    CHECK(stats.retired_slots == 6);
+    CHECK(stats.free_list_size == 7);
+    CHECK(stats.free_list_length == 0);
+
+    // Retired slots stay in the sparse array when trimming
+    arena.release(live);
+    arena.trim();
+    CHECK(arena.raw().stats().free_list_size == 6);
+    CHECK(arena.raw().stats().retired_slots == 6);
+    for (auto ref : refs) {
+        CHECK(!arena.is_valid_ref(ref));
+    }
+
+    // The handle allocator retires its slots as well
+    GenHandleAllocator<TinyConfig> handles;
+    handles.setup(0);
+    for (uint32_t iter = 0; iter < 30; iter++) {
+        GenHandleAllocator<TinyConfig>::Ref ref;
+        REQUIRE(handles.allocate(ref) == GenArenaResult::Ok);
+        handles.free(ref);
+    }
+    CHECK(handles.retired_count() == 2);
+    std::vector<GenHandleAllocator<TinyConfig>::Ref> batch(4);
+    REQUIRE(handles.allocate_batch(batch.data(), 4) == GenArenaResult::Ok);
+    CHECK(handles.free_list_size() == 6);
+    handles.release();
+}
+
+TEST_CASE("gen_handle_allocator_test") {
+    using Ref = GenHandleAllocator<>::Ref;
+    const uint32_t test_size = 1000;
+
+    GenHandleAllocator<> handles;
+    handles.setup(0);
+
+    std::vector<Ref> refs(test_size);
+    REQUIRE(handles.allocate_batch(refs.data(), test_size) == GenArenaResult::Ok);
+    CHECK(handles.size() == test_size);
+    for (uint32_t i = 0; i < test_size; i++) {
+        CHECK(handles.is_valid_ref(refs[i]));
+    }
+
+    // Free every third handle
+    std::vector<Ref> freed;
+    for (uint32_t i = 0; i < test_size; i += 3) {
+        freed.push_back(refs[i]);
+    }
+    CHECK(handles.free_batch(freed.data(), (uint32_t) freed.size()) == GenArenaResult::Ok);
+    CHECK(handles.size() == test_size - freed.size());
+    for (auto ref: freed) {
+        CHECK(!handles.is_valid_ref(ref));
+    }
+    CHECK(handles.free(freed[0]) == GenArenaResult::RefInvalid);
+
+    uint32_t live = 0;
+    uint32_t prev_index = 0;
+    handles.foreach_live([&](Ref ref) {
+        CHECK(handles.is_valid_ref(ref));
+        CHECK(ref.index() % 3 != 0);
+        CHECK((live == 0 || ref.index() > prev_index));
+        prev_index = ref.index();
+        live++;
+    });
+    CHECK(live == handles.size());
+
+    // Freed slots are reused (with a new generation) before new ones are created
+    Ref ref;
+    REQUIRE(handles.allocate(ref) == GenArenaResult::Ok);
+    CHECK(ref.index() == freed[0].index());
+    CHECK(ref.generation() == freed[0].generation() + 1);
+    CHECK(handles.free_list_size() == test_size);
+
+    handles.release();
+}
+
+template <class Map>
+static void test_secondary_map() {
+    const uint32_t test_size = 512;
+    GenArena<Obj> arena;
+    Map names;
+
+    std::vector<GenArena<Obj>::Ref> refs(test_size);
+    for (uint32_t i = 0; i < test_size; i++) {
+        refs[i] = arena.emplace(i).first;
+        // Only give names to some of the items
+        if (i % 2 == 0) {
+            names.insert(refs[i], "obj_" + std::to_string(i) + "_with_a_name_too_long_for_sso");
+        }
+    }
+    CHECK(names.size() == test_size / 2);
+
+    for (uint32_t i = 0; i < test_size; i++) {
+        auto* name = names.try_get(refs[i]);
+        if (i % 2 == 0) {
+            REQUIRE(name != nullptr);
+            CHECK(*name == "obj_" + std::to_string(i) + "_with_a_name_too_long_for_sso");
+        } else {
+            CHECK(name == nullptr);
+        }
+    }
+
+    // Stale refs read as missing, even if the slot is reused
+    arena.release(refs[0]);
+    auto reused = arena.emplace(1000).first;
+    CHECK(reused.index() == refs[0].index());
+    CHECK(names.try_get(reused) == nullptr);
+    CHECK(names.contains(refs[0]));
+    names.insert(reused, "reused");
+    CHECK(!names.contains(refs[0]));
+    CHECK(*names.try_get(reused) == "reused");
+    CHECK(names.size() == test_size / 2);
+
+    // Values can be replaced with (and inserted from) values of the map itself, even when that grows the map
+    names.emplace(reused, *names.try_get(reused) + "_again");
+    CHECK(*names.try_get(reused) == "reused_again");
+    names.insert(reused, *names.try_get(reused));
+    CHECK(*names.try_get(reused) == "reused_again");
+    Map copies;
+    copies.insert(refs[2], *names.try_get(refs[2]));
+    auto far_ref = GenArenaRef<>::make(4 * test_size, 0, 1);
+    copies.insert(far_ref, *copies.try_get(refs[2]));
+    CHECK(*copies.try_get(far_ref) == *names.try_get(refs[2]));
+    CHECK(*copies.try_get(refs[2]) == *names.try_get(refs[2]));
+
+    for (uint32_t i = 2; i < test_size; i += 4) {
+        CHECK(names.remove(refs[i]));
+        CHECK(!names.remove(refs[i]));
+    }
+    CHECK(names.size() == test_size / 4);
+
+    uint32_t count = 0;
+    names.foreach_ref_val([&](GenArenaRef<> ref, std::string& name) {
+        CHECK(names.try_get(ref) == &name);
+        count++;
+    });
+    CHECK(count == names.size());
+}
+
+TEST_CASE("gen_secondary_map_test") {
+    test_secondary_map<GenSecondaryMap<std::string>>();
+    test_secondary_map<GenDenseSecondaryMap<std::string>>();
+}
+
+struct Position {
+    float x, y;
+};
+
+struct Velocity {
+    float dx, dy;
+};
+
+TEST_CASE("gen_arena_join_test") {
+    using Ref = GenHandleAllocator<>::Ref;
+    const uint32_t test_size = 1000;
+
+    GenHandleAllocator<> entities;
+    entities.setup(0);
+    GenArena<Position> positions;
+    GenArena<Velocity> velocities;
+    GenArena<Obj> objs;
+
+    std::vector<Ref> refs(test_size);
+    REQUIRE(entities.allocate_batch(refs.data(), test_size) == GenArenaResult::Ok);
+    for (uint32_t i = 0; i < test_size; i++) {
+        if (i % 2 == 0) REQUIRE(positions.emplace_at(refs[i], Position{(float) i, 0.0f}) != nullptr);
+        if (i % 3 == 0) REQUIRE(velocities.emplace_at(refs[i], Velocity{1.0f, (float) i}) != nullptr);
+        if (i % 5 == 0) REQUIRE(objs.emplace_at(refs[i], i) != nullptr);
+    }
+    // A ref can only have one item per arena
+    CHECK(positions.emplace_at(refs[0], Position{0.0f, 0.0f}) == nullptr);
+
+    // Despawn some entities, and reuse their slots for new ones (which are stale for the old items)
+    for (uint32_t i = 0; i < test_size; i += 4) {
+        if (positions.try_get(GenArena<Position>::Ref(refs[i]))) positions.release(GenArena<Position>::Ref(refs[i]));
+        entities.free(refs[i]);
+    }
+    for (uint32_t i = 0; i < test_size; i += 4) {
+        REQUIRE(entities.allocate(refs[i]) == GenArenaResult::Ok);
+    }
+
+    auto expected_match = [&](uint32_t i) {
+        return i % 2 == 0 && i % 4 != 0 && i % 3 == 0;
+    };
+
+    uint32_t matches = 0;
+    gen_arena_join([&](GenArenaRef<> ref, Position& pos, Velocity& vel) {
+        uint32_t i = (uint32_t) pos.x;
+        CHECK(expected_match(i));
+        CHECK(vel.dy == pos.x);
+        CHECK(ref == refs[i]);
+        matches++;
+    }, positions, velocities);
+
+    uint32_t expected = 0;
+    for (uint32_t i = 0; i < test_size; i++) {
+        if (expected_match(i)) expected++;
+    }
+    CHECK(matches == expected);
+
+    // The join works the same regardless of which arena drives it
+    uint32_t triple_matches = 0;
+    gen_arena_join([&](GenArenaRef<> ref, Obj& obj, Position& pos, Velocity& vel) {
+        CHECK(obj.a == (uint32_t) pos.x);
+        CHECK(expected_match(obj.a));
+        CHECK(obj.a % 5 == 0);
+        triple_matches++;
+    }, objs, positions, velocities);
+    uint32_t triple_expected = 0;
+    for (uint32_t i = 0; i < test_size; i++) {
+        if (expected_match(i) && i % 5 == 0) triple_expected++;
+    }
+    CHECK(triple_matches == triple_expected);
+
+    entities.release();
+}
+
+TEST_CASE("gen_arena_owning_group_test") {
+    using Ref = GenHandleAllocator<>::Ref;
+    const uint32_t test_size = 1000;
+
+    GenHandleAllocator<> entities;
+    entities.setup(0);
+    GenArena<Position> positions;
+    GenArena<Velocity> velocities;
+    auto group = gen_arena_make_owning_group(positions, velocities);
+
+    std::vector<Ref> refs(test_size);
+    REQUIRE(entities.allocate_batch(refs.data(), test_size) == GenArenaResult::Ok);
+    for (uint32_t i = 0; i < test_size; i++) {
+        if (i % 2 == 0) REQUIRE(group.emplace_at(positions, refs[i], Position{(float) i, 0.0f}) != nullptr);
+        if (i % 3 == 0) REQUIRE(group.emplace_at(velocities, refs[i], Velocity{1.0f, (float) i}) != nullptr);
+    }
+    for (uint32_t i = 0; i < test_size; i += 4) {
+        if (positions.try_get(GenArena<Position>::Ref(refs[i]))) group.release(positions, refs[i]);
+    }
+
+    auto check_group = [&]() {
+        // The owned items are packed at the front of both arenas in the same order
+        for (uint32_t i = 0; i < group.size(); i++) {
+            CHECK(positions.raw().metadata_buf()[i].dense_to_sparse == velocities.raw().metadata_buf()[i].dense_to_sparse);
+        }
+        uint32_t joined = 0;
+        gen_arena_join([&](GenArenaRef<> ref, Position& pos, Velocity& vel) {
+            CHECK(group.contains(ref));
+            joined++;
+        }, positions, velocities);
+        CHECK(joined == group.size());
+
+        uint32_t visited = 0;
+        group.foreach_ref_val([&](GenArenaRef<> ref, Position& pos, Velocity& vel) {
+            CHECK(vel.dy == pos.x);
+            CHECK(ref == refs[(uint32_t) pos.x]);
+            visited++;
+        }, positions, velocities);
+        CHECK(visited == group.size());
+    };
+    check_group();
+
+    uint32_t expected = 0;
+    for (uint32_t i = 0; i < test_size; i++) {
+        if (i % 2 == 0 && i % 4 != 0 && i % 3 == 0) expected++;
+    }
+    CHECK(group.size() == expected);
+
+    // Rebuilding the group over its arenas collects the same items (a second group can't own the same arenas)
+    group.rebuild();
+    CHECK(group.size() == expected);
+    check_group();
+    for (uint32_t i = 1; i < test_size; i += 4) {
+        if (velocities.try_get(GenArena<Velocity>::Ref(refs[i]))) group.release(velocities, refs[i]);
+    }
+    check_group();
+
+    // A group made over arenas that were filled without one collects the refs that are in both
+    GenArena<Position> loose_positions;
+    GenArena<Velocity> loose_velocities;
+    uint32_t in_both = 0;
+    for (uint32_t i = 0; i < test_size; i++) {
+        if (i % 2 == 0) loose_positions.emplace_at(refs[i], Position{(float) i, 0.0f});
+        if (i % 5 == 0) loose_velocities.emplace_at(refs[i], Velocity{1.0f, (float) i});
+        if (i % 10 == 0) in_both++;
+    }
+    auto late_group = gen_arena_make_owning_group(loose_positions, loose_velocities);
+    CHECK(late_group.size() == in_both);
+    for (uint32_t i = 0; i < late_group.size(); i++) {
+        CHECK(loose_positions.raw().metadata_buf()[i].dense_to_sparse == loose_velocities.raw().metadata_buf()[i].dense_to_sparse);
+    }
+
+    entities.release();
+}
+
+struct CountingAllocator {
+    uint32_t live_allocations = 0;
+    size_t live_bytes = 0;
+
+    static void* allocate(void* ctx, size_t size, size_t alignment) {
+        CountingAllocator* self = static_cast<CountingAllocator*>(ctx);
+        self->live_allocations++;
+        self->live_bytes += size;
+        return gen_arena_aligned_alloc(size, alignment);
+    }
+
+    static void deallocate(void* ctx, void* ptr, size_t size, size_t alignment) {
+        CountingAllocator* self = static_cast<CountingAllocator*>(ctx);
+        self->live_allocations--;
+        self->live_bytes -= size;
+        gen_arena_aligned_free(ptr);
+    }
+};
+
+TEST_CASE("gen_arena_allocator_test") {
+    CountingAllocator counter;
+    GenArenaAllocator allocator = {&CountingAllocator::allocate, &CountingAllocator::deallocate, &counter};
+
+    {
+        GenArena<Obj> arena(&allocator);
+        CHECK(arena.allocator() == &allocator);
+        CHECK(counter.live_allocations == 0);
+
+        std::vector<GenArena<Obj>::Ref> refs;
+        for (uint32_t i = 0; i < 1000; i++) {
+            refs.push_back(arena.emplace(i).first);
+        }
+        // Items, metadata, and the page table and the single page of the free list
+        CHECK(counter.live_allocations == 4);
+        CHECK(counter.live_bytes > 1000 * sizeof(Obj));
+
+        for (uint32_t i = 0; i < 1000; i += 2) {
+            arena.release(refs[i]);
+        }
+        REQUIRE(arena.shrink() == GenArenaResult::Ok);
+        CHECK(counter.live_allocations == 4);
+        for (uint32_t i = 1; i < 1000; i += 2) {
+            CHECK(arena.get(refs[i])->a == i);
+        }
+
+        // Arenas without an allocator don't touch it
+        GenArena<Obj> other;
+        other.emplace(0u);
+        CHECK(other.allocator() == gen_arena_default_allocator());
+        CHECK(counter.live_allocations == 4);
+
+        // Handle allocators put their live bitmap in the allocator too
+        GenHandleAllocator<> handles;
+        REQUIRE(handles.setup(0, 0, &allocator) == GenArenaResult::Ok);
+        std::vector<GenHandleAllocator<>::Ref> handle_refs(1000);
+        REQUIRE(handles.allocate_batch(handle_refs.data(), 1000) == GenArenaResult::Ok);
+        CHECK(counter.live_allocations == 4 + 3);
+        handles.release();
+        CHECK(counter.live_allocations == 4);
+    }
+    // Deallocations get the same sizes as the allocations
+    CHECK(counter.live_allocations == 0);
+    CHECK(counter.live_bytes == 0);
+}
+
+// Counts the allocations like CountingAllocator, but fails the allocations of the given size
+struct FailingAllocator {
+    CountingAllocator counter;
+    size_t fail_size = 0;
+
+    static void* allocate(void* ctx, size_t size, size_t alignment) {
+        FailingAllocator* self = static_cast<FailingAllocator*>(ctx);
+        if (size == self->fail_size) return nullptr;
+        return CountingAllocator::allocate(&self->counter, size, alignment);
+    }
+
+    static void deallocate(void* ctx, void* ptr, size_t size, size_t alignment) {
+        CountingAllocator::deallocate(&static_cast<FailingAllocator*>(ctx)->counter, ptr, size, alignment);
+    }
+};
+
+TEST_CASE("gen_arena_out_of_memory_test") {
+    FailingAllocator failing;
+    GenArenaAllocator allocator = {&FailingAllocator::allocate, &FailingAllocator::deallocate, &failing};
+
+    {
+        GenArena<Obj> arena(&allocator);
+        std::vector<GenArena<Obj>::Ref> refs;
+        for (uint32_t i = 0; i < 100; i++) {
+            refs.push_back(arena.emplace(i).first);
+        }
+        REQUIRE(arena.capacity() == 128);
+
+        // The metadata grows, but the items can't: the arena keeps its capacity and items
+        failing.fail_size = sizeof(Obj) * 1024;
+        CHECK(arena.resize(1024) == GenArenaResult::OutOfMemory);
+        CHECK(arena.capacity() == 128);
+        CHECK(arena.memory_report().metadata_bytes_reserved == sizeof(GenArenaMetadata) * 1024);
+        for (uint32_t i = 0; i < 100; i++) {
+            CHECK(arena.get(refs[i])->a == i);
+        }
+        for (uint32_t i = 100; i < 500; i++) {
+            refs.push_back(arena.emplace(i).first);
+        }
+        for (uint32_t i = 0; i < 500; i++) {
+            CHECK(arena.get(refs[i])->a == i);
+        }
+
+        // Shrinking the metadata fails, but the items still shrink
+        for (uint32_t i = 0; i < 400; i++) {
+            arena.release(refs[i]);
+        }
+        failing.fail_size = sizeof(GenArenaMetadata) * 128;
+        CHECK(arena.shrink() == GenArenaResult::Ok);
+        CHECK(arena.capacity() == 128);
+        CHECK(arena.memory_report().metadata_bytes_reserved == sizeof(GenArenaMetadata) * 512);
+        for (uint32_t i = 400; i < 500; i++) {
+            CHECK(arena.get(refs[i])->a == i);
+        }
+        failing.fail_size = 0;
+        CHECK(arena.resize(256) == GenArenaResult::Ok);
+        CHECK(arena.memory_report().metadata_bytes_reserved == sizeof(GenArenaMetadata) * 256);
+    }
+    // Nothing leaked, and the deallocations got the sizes of the allocations
+    CHECK(failing.counter.live_allocations == 0);
+    CHECK(failing.counter.live_bytes == 0);
+}
+
+TEST_CASE("gen_arena_large_growth_test") {
+    // Big enough for the buffers to be mapped pages (and grown with mremap) on Linux
+    const uint32_t test_size = 1 << 18;
+
+    GenArena<Obj> arena;
+    std::vector<GenArena<Obj>::Ref> refs(test_size);
+    for (uint32_t i = 0; i < test_size; i++) {
+        refs[i] = arena.emplace(i).first;
+    }
+    for (uint32_t i = 0; i < test_size; i++) {
+        REQUIRE(arena.get(refs[i])->a == i);
+    }
+
+    // Shrink it back below the threshold, and grow it again
+    for (uint32_t i = 0; i < test_size; i++) {
+        if (i % 64 != 0) arena.release(refs[i]);
+    }
+    REQUIRE(arena.shrink() == GenArenaResult::Ok);
+    CHECK(arena.capacity() == test_size / 64);
+    for (uint32_t i = 0; i < test_size; i += 64) {
+        REQUIRE(arena.get(refs[i])->a == i);
+    }
+    REQUIRE(arena.resize(4 * test_size) == GenArenaResult::Ok);
+    for (uint32_t i = 0; i < test_size; i += 64) {
+        REQUIRE(arena.get(refs[i])->a == i);
+    }
+
+    // Memory options are only hints, so the arena should work the same with them
+    GenArenaMemoryOptions options = {};
+    options.huge_pages = true;
+    options.numa_policy = GenArenaNumaPolicy::Interleave;
+    GenArena<Obj> tuned;
+    tuned.set_memory_options(options);
+    CHECK(tuned.memory_options().huge_pages);
+    for (uint32_t i = 0; i < test_size; i++) {
+        refs[i] = tuned.emplace(i).first;
+    }
+    options.numa_policy = GenArenaNumaPolicy::Bind;
+    tuned.set_memory_options(options);
+    REQUIRE(tuned.resize(2 * test_size) == GenArenaResult::Ok);
+    for (uint32_t i = 0; i < test_size; i++) {
+        REQUIRE(tuned.get(refs[i])->a == i);
+    }
+}
+
+TEST_CASE("gen_arena_growth_policy_test") {
+    GenArena<uint64_t> arena;
+    CHECK(arena.growth_policy().factor == 2.0);
+
+    // Linear growth in big steps
+    GenArenaGrowthPolicy linear = {1.0, 1000, 0, false};
+    arena.set_growth_policy(linear);
+    arena.insert(0);
+    CHECK(arena.capacity() == 1000);
+    for (uint64_t i = 1; i < 1001; i++) arena.insert(i);
+    CHECK(arena.capacity() == 2000);
+    CHECK(arena.raw().free_list_capacity() >= 2000);
+
+    // Doubling, but at most 3000 items at a time
+    GenArenaGrowthPolicy capped = {2.0, 1, 3000, false};
+    arena.set_growth_policy(capped);
+    for (uint64_t i = arena.size(); i < 5001; i++) arena.insert(i);
+    CHECK(arena.capacity() == 7000); // 2000 -> 4000 -> 7000
+
+    // A whole page of items right away
+    GenArena<uint64_t> paged;
+    GenArenaGrowthPolicy pages = {2.0, 1, 0, true};
+    paged.set_growth_policy(pages);
+    paged.insert(1);
+    CHECK(paged.capacity() * sizeof(uint64_t) % 4096 == 0);
+    CHECK(paged.capacity() >= 4096 / sizeof(uint64_t));
+
+    // The sparse and dense buffers can be reserved separately
+    GenArena<uint64_t> reserved;
+    CHECK(reserved.reserve_sparse(10000) == GenArenaResult::Ok);
+    CHECK(reserved.raw().free_list_capacity() >= 10000);
+    CHECK(reserved.capacity() == 0);
+    CHECK(reserved.reserve_dense(100) == GenArenaResult::Ok);
+    CHECK(reserved.capacity() == 100);
+    CHECK(reserved.raw().free_list_capacity() == 3 * GenArenaFreeList<GenArenaDefaultConfig>::PAGE_SIZE);
+    CHECK(reserved.reserve_dense(50) == GenArenaResult::Ok);
+    CHECK(reserved.capacity() == 100);
+
+    // Churning through many refs with few live items doesn't grow the dense buffers
+    for (uint32_t i = 0; i < 9900; i++) {
+        GenArena<uint64_t>::Ref ref = reserved.insert(i).first;
+        if (i % 100 != 0) reserved.release(ref); // Keeps 99 items
+    }
+    CHECK(reserved.capacity() == 100);
+}
+
+TEST_CASE("gen_arena_reuse_policy_test") {
+    GenArena<uint64_t> fifo;
+    std::vector<GenArena<uint64_t>::Ref> refs;
+    for (uint64_t i = 0; i < 4; i++) refs.push_back(fifo.insert(i).first);
+    fifo.release(refs[1]);
+    fifo.release(refs[2]);
+    CHECK(fifo.reuse_policy().order == GenArenaReuseOrder::Fifo);
+    CHECK(fifo.insert(10).first.index() == 1);
+    CHECK(fifo.insert(11).first.index() == 2);
+
+    GenArena<uint64_t> lifo;
+    lifo.set_reuse_policy({GenArenaReuseOrder::Lifo, 0});
+    refs.clear();
+    for (uint64_t i = 0; i < 4; i++) refs.push_back(lifo.insert(i).first);
+    lifo.release(refs[1]);
+    lifo.release(refs[2]);
+    CHECK(lifo.insert(10).first.index() == 2);
+    CHECK(lifo.insert(11).first.index() == 1);
+    CHECK(!lifo.is_valid_ref(refs[1]));
+    CHECK(!lifo.is_valid_ref(refs[2]));
+
+    // Released slots aren't reused before 3 other releases
+    GenArena<uint64_t> quarantined;
+    quarantined.set_reuse_policy({GenArenaReuseOrder::Fifo, 3});
+    refs.clear();
+    for (uint64_t i = 0; i < 8; i++) refs.push_back(quarantined.insert(i).first);
+    for (uint32_t i = 0; i < 3; i++) quarantined.release(refs[i]);
+    CHECK(quarantined.insert(8).first.index() == 8);
+    quarantined.release(refs[3]);
+    CHECK(quarantined.insert(9).first.index() == 0);
+    CHECK(quarantined.raw().stats().free_list_length == 3);
+
+    // ...unless all indices are taken (3 index bits leave 7 slots)
+    using TinyConfig = GenArenaConfig<3, 0, 8>;
+    GenArena<uint64_t, TinyConfig> tiny;
+    tiny.set_reuse_policy({GenArenaReuseOrder::Fifo, 4});
+    std::vector<GenArena<uint64_t, TinyConfig>::Ref> tiny_refs;
+    for (uint64_t i = 0; i < 7; i++) tiny_refs.push_back(tiny.insert(i).first);
+    tiny.release(tiny_refs[5]);
+    auto res = tiny.insert(7);
+    REQUIRE(res.first.index() == 5);
+    CHECK(*tiny.get(res.first) == 7);
+}
+
+TEST_CASE("gen_arena_get_pipelined_test") {
+    GenArena<uint64_t> arena;
+    std::vector<GenArena<uint64_t>::Ref> refs;
+    for (uint64_t i = 0; i < 1000; i++) refs.push_back(arena.insert(i).first);
+    std::shuffle(refs.begin(), refs.end(), std::mt19937(1234));
+
+    // Stale and out of range refs are skipped
+    for (uint32_t i = 0; i < 100; i++) arena.release(refs[i * 10]);
+    refs.push_back(GenArena<uint64_t>::Ref(GenArenaRef<>::make(5000, gen_arena_type_id<uint64_t>(), 1)));
+    arena.prefetch(refs.back());
+
+    uint64_t expected = 0;
+    for (auto ref : refs) {
+        arena.prefetch(ref);
+        const uint64_t* value = arena.try_get(ref);
+        if (value) expected += *value;
+    }
+
+    uint64_t sum = 0;
+    uint32_t calls = 0;
+    uint32_t visited = arena.get_pipelined(refs.data(), (uint32_t) refs.size(), [&](GenArena<uint64_t>::Ref ref, uint64_t& value) {
+        CHECK(arena.get(ref) == &value);
+        sum += value;
+        value++;
+        calls++;
+    });
+    CHECK(visited == 900);
+    CHECK(calls == 900);
+    CHECK(sum == expected);
+
+    const GenArena<uint64_t>& const_arena = arena;
+    sum = 0;
+    const_arena.get_pipelined(refs.data(), (uint32_t) refs.size(), [&](GenArena<uint64_t>::Ref, const uint64_t& value) { sum += value; });
+    CHECK(sum == expected + 900);
+}
+
+TEST_CASE("gen_arena_trim_test") {
+    using SmallConfig = GenArenaConfig<20, 0, 12>;
+    const uint32_t test_size = 1 << 17;
+
+    GenArena<Obj> arena;
+    std::vector<GenArena<Obj>::Ref> refs(test_size);
+    for (uint32_t i = 0; i < test_size; i++) {
+        refs[i] = arena.emplace(i).first;
+    }
+    // Despawn wave: only a few items at the front survive
+    for (uint32_t i = 0; i < test_size; i++) {
+        if (i >= 100 || i % 10 != 0) arena.release(refs[i]);
+    }
+    uint32_t capacity = arena.capacity();
+    arena.trim();
+
+    // Nothing moves, and the sparse slots after the last live one are dropped
+    CHECK(arena.capacity() == capacity);
+    CHECK(arena.size() == 10);
+    CHECK(arena.raw().free_list_size() == 91);
+    for (uint32_t i = 0; i < test_size; i++) {
+        CHECK(arena.is_valid_ref(refs[i]) == (i < 100 && i % 10 == 0));
+    }
+
+    // Slots are reused (and appended again) without reviving stale refs
+    std::vector<GenArena<Obj>::Ref> new_refs;
+    for (uint32_t i = 0; i < test_size; i++) {
+        new_refs.push_back(arena.emplace(i).first);
+    }
+    for (uint32_t i = 0; i < test_size; i++) {
+        CHECK(arena.is_valid_ref(refs[i]) == (i < 100 && i % 10 == 0));
+        CHECK(arena.get(new_refs[i])->a == i);
+    }
+
+    // Sparse pages whose slots are all free are freed too, even below the last live slot
+    const uint32_t page_size = GenArenaFreeList<GenArenaDefaultConfig>::PAGE_SIZE;
+    GenArena<Obj> sparse;
+    std::vector<GenArena<Obj>::Ref> sparse_refs;
+    for (uint32_t i = 0; i < 8 * page_size; i++) {
+        sparse_refs.push_back(sparse.emplace(i).first);
+    }
+    for (uint32_t i = 0; i < 7 * page_size; i++) {
+        sparse.release(sparse_refs[i]);
+    }
+    size_t sparse_bytes = sparse.memory_report().sparse_bytes_reserved;
+    sparse.trim();
+    CHECK(sparse.memory_report().sparse_bytes_reserved < sparse_bytes / 4);
+    CHECK(sparse.raw().stats().free_list_length == 0);
+    for (uint32_t i = 0; i < 8 * page_size; i++) {
+        CHECK(sparse.is_valid_ref(sparse_refs[i]) == (i >= 7 * page_size));
+    }
+
+    // New items reuse the freed pages, without reviving stale refs
+    std::vector<GenArena<Obj>::Ref> more_refs;
+    for (uint32_t i = 0; i < 2 * page_size; i++) {
+        more_refs.push_back(sparse.emplace(i).first);
+        CHECK(more_refs.back().index() < 7 * page_size);
+    }
+    CHECK(sparse.raw().free_list_size() == 8 * page_size);
+    for (uint32_t i = 0; i < 8 * page_size; i++) {
+        CHECK(sparse.is_valid_ref(sparse_refs[i]) == (i >= 7 * page_size));
+    }
+    for (uint32_t i = 0; i < 2 * page_size; i++) {
+        CHECK(sparse.get(more_refs[i])->a == i);
+    }
+
+    // Dropping a page that an earlier trim() freed keeps its generations, so stale refs to its slots stay invalid
+    GenArena<Obj, SmallConfig> twice;
+    twice.set_reuse_policy({GenArenaReuseOrder::Lifo, 0});
+    std::vector<GenArena<Obj, SmallConfig>::Ref> twice_refs;
+    for (uint32_t i = 0; i < 2 * page_size + 1; i++) {
+        twice_refs.push_back(twice.emplace(i).first);
+    }
+    std::vector<GenArena<Obj, SmallConfig>::Ref> stale;
+    for (uint32_t i = 0; i < 5; i++) {
+        stale.push_back(twice_refs[page_size]);
+        twice.release(twice_refs[page_size]);
+        twice_refs[page_size] = twice.emplace(0u).first;
+        REQUIRE(twice_refs[page_size].index() == page_size);
+    }
+    for (uint32_t i = page_size; i < 2 * page_size; i++) {
+        twice.release(twice_refs[i]);
+    }
+    twice.trim();
+    for (uint32_t i = 0; i < page_size; i++) {
+        twice.release(twice_refs[i]);
+    }
+    twice.release(twice_refs[2 * page_size]);
+    twice.trim();
+    CHECK(twice.raw().free_list_size() == 0);
+    for (uint32_t i = 0; i < 2 * page_size + 1; i++) {
+        twice.emplace(i);
+    }
+    for (auto ref : stale) {
+        CHECK(!twice.is_valid_ref(ref));
+    }
+
+    // With few index bits, the used count of a full page can be the largest index, and the page still mustn't be freed
+    using TinyConfig = GenArenaConfig<3, 0, 8>;
+    GenArena<Obj, TinyConfig> tiny;
+    std::vector<GenArena<Obj, TinyConfig>::Ref> tiny_refs;
+    for (uint32_t i = 0; i < 7; i++) {
+        tiny_refs.push_back(tiny.emplace(i).first);
+    }
+    tiny.trim();
+    CHECK(tiny.size() == 7);
+    for (uint32_t i = 0; i < 7; i++) {
+        REQUIRE(tiny.is_valid_ref(tiny_refs[i]));
+        CHECK(tiny.get(tiny_refs[i])->a == i);
+    }
+
+    using PageConfig = GenArenaConfig<12, 4, 16>;
+    GenArena<Obj, PageConfig> full_page;
+    std::vector<GenArena<Obj, PageConfig>::Ref> full_page_refs;
+    for (uint32_t i = 0; i < 4095; i++) {
+        full_page_refs.push_back(full_page.emplace(i).first);
+    }
+    full_page.trim();
+    uint32_t valid = 0;
+    for (auto ref : full_page_refs) {
+        if (full_page.is_valid_ref(ref)) valid++;
+    }
+    CHECK(valid == 4095);
+}
+
+TEST_CASE("gen_arena_trim_reacquire_test") {
+    using Ref = GenArena<Obj>::Ref;
+    const uint32_t page_size = GenArenaFreeList<GenArenaDefaultConfig>::PAGE_SIZE;
+    const uint32_t slot_count = 5 * page_size + page_size / 2;
+
+    // With placement options, the full sparse pages are mapped (on Linux), which trim() then unmaps one by one
+    GenArenaMemoryOptions options = {};
+    options.huge_pages = true;
+    GenArena<Obj> arena;
+    arena.set_memory_options(options);
+
+    // Bump the generations of the slots around the page boundaries, so that each slot has its own
+    std::vector<Ref> refs;
+    for (uint32_t i = 0; i < slot_count; i++) {
+        refs.push_back(arena.emplace(i).first);
+    }
+    arena.set_reuse_policy({GenArenaReuseOrder::Lifo, 0});
+    for (uint32_t page = 1; page < 6; page++) {
+        for (uint32_t i = page * page_size - 3; i < page * page_size + 3; i++) {
+            for (uint32_t n = 0; n < i % 7; n++) {
+                arena.release(refs[i]);
+                refs[i] = arena.emplace(i).first;
+                REQUIRE(refs[i].index() == i);
+            }
+        }
+    }
+
+    // Keep a few items on each side of the freed pages (1 and 2), and drop the tail after the page 4 boundary
+    std::vector<uint32_t> stale_generation(slot_count, 0);
+    for (uint32_t i = 0; i < slot_count; i++) {
+        bool keep = (i < page_size && i % 100 == 0) || i == page_size - 1 || i == 3 * page_size ||
+                    (i > 3 * page_size && i < 4 * page_size + 2);
+        if (!keep) {
+            stale_generation[refs[i].index()] = refs[i].generation();
+            arena.release(refs[i]);
+        }
+    }
+    arena.trim();
+    CHECK(arena.raw().free_list_size() == 4 * page_size + 2);
+
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < slot_count; i++) {
+        bool live = stale_generation[i] == 0;
+        wrong += arena.is_valid_ref(refs[i]) != live;
+        if (live) wrong += arena.get(refs[i])->a != i;
+    }
+    CHECK(wrong == 0);
+
+    // Reacquire every slot: the new generations are all above the stale ones, on both sides of each page boundary
+    std::vector<Ref> new_refs;
+    while (arena.raw().free_list_size() < slot_count || arena.raw().stats().free_list_length > 0) {
+        new_refs.push_back(arena.emplace(0u).first);
+    }
+    for (Ref ref : new_refs) {
+        wrong += ref.generation() <= stale_generation[ref.index()];
+    }
+    for (uint32_t i = 0; i < slot_count; i++) {
+        wrong += arena.is_valid_ref(refs[i]) != (stale_generation[i] == 0);
+    }
+    CHECK(wrong == 0);
+    CHECK(arena.size() == slot_count);
+}
+
+TEST_CASE("gen_arena_fixed_test") {
+    static_assert(GenArenaFixed<Obj, 16>::capacity() == 16, "capacity() should be constexpr");
+    // Small capacities use small index types
+    static_assert(sizeof(GenArenaFixed<uint32_t, 200, GenArenaConfig<20, 0, 12>>) <
+                  sizeof(GenArenaFixed<uint32_t, 200>), "Indices should shrink with the capacity and generation bits");
+
+    GenArenaFixed<std::string, 200> arena;
+    using Ref = GenArenaFixed<std::string, 200>::Ref;
+    std::vector<Ref> refs;
+    for (uint32_t i = 0; i < 200; i++) {
+        auto pair = arena.emplace(std::to_string(i) + " with a string too long for small string optimization");
+        REQUIRE(pair.second != nullptr);
+        refs.push_back(pair.first);
+    }
+    CHECK(arena.full());
+
+    // Inserting into a full arena fails without touching anything
+    auto overflow = arena.emplace("overflow");
+    CHECK(overflow.second == nullptr);
+    CHECK(!arena.is_valid_ref(overflow.first));
+    CHECK(arena.size() == 200);
+
+    for (uint32_t i = 0; i < 200; i += 3) {
+        CHECK(arena.release(refs[i]));
+    }
+    CHECK(!arena.release(refs[0]));
+    for (uint32_t i = 0; i < 200; i++) {
+        CHECK(arena.is_valid_ref(refs[i]) == (i % 3 != 0));
+        if (i % 3 != 0) CHECK(arena.get(refs[i])->substr(0, std::to_string(i).size() + 1) == std::to_string(i) + " ");
+    }
+
+    // Freed slots are reused with new generations
+    for (uint32_t i = 0; i < 200; i += 3) {
+        auto pair = arena.emplace("new");
+        REQUIRE(pair.second != nullptr);
+        CHECK(arena.try_get(refs[i]) == nullptr);
+        refs[i] = pair.first;
+    }
+    uint32_t count = 0;
+    arena.foreach_ref_val([&](Ref ref, std::string& value) {
+        CHECK(arena.get(ref) == &value);
+        count++;
+    });
+    CHECK(count == 200);
+
+    arena.clear();
+    CHECK(arena.empty());
+    for (Ref ref : refs) {
+        CHECK(!arena.is_valid_ref(ref));
+    }
+
+    // Generations wrap around without ever reaching 0, which the ref of a failed emplace uses
+    GenArenaFixed<uint32_t, 1, GenArenaConfig<20, 0, 12>> single;
+    auto first = single.emplace(0u);
+    auto failed = single.emplace(1u);
+    REQUIRE(failed.second == nullptr);
+    CHECK(failed.first.generation() == 0);
+    uint32_t zero_generations = 0;
+    for (uint32_t i = 0; i < 3 * 4096; i++) {
+        auto pair = single.emplace(i);
+        if (pair.second == nullptr) {
+            single.release(first.first);
+            pair = single.emplace(i);
+        }
+        zero_generations += pair.first.generation() == 0;
+        zero_generations += single.is_valid_ref(failed.first);
+        single.release(pair.first);
+    }
+    CHECK(zero_generations == 0);
+}
+
+TEST_CASE("gen_arena_cache_test") {
+    using Cache = GenArenaCache<Obj>;
+    struct Evicted {
+        std::vector<uint32_t> values;
+
+        static void on_evict(void* ctx, Cache::Ref ref, Obj& value) {
+            static_cast<Evicted*>(ctx)->values.push_back(value.a);
+        }
+    };
+
+    Evicted evicted;
+    Cache cache(4);
+    cache.set_eviction_callback(&Evicted::on_evict, &evicted);
+
+    std::vector<Cache::Ref> refs;
+    for (uint32_t i = 0; i < 4; i++) {
+        refs.push_back(cache.emplace(i).first);
+    }
+    CHECK(evicted.values.empty());
+
+    // All items are referenced after insertion, so the clock hand goes around once (clearing the bits) and evicts the first item.
+    // Item 3 is moved into its place, which is the next one to be evicted. Touching item 2 doesn't change that.
+    refs.push_back(cache.emplace(4u).first);
+    CHECK(evicted.values == std::vector<uint32_t>{0});
+    CHECK(cache.try_get(refs[0]) == nullptr);
+    REQUIRE(cache.try_get(refs[2]) != nullptr);
+    refs.push_back(cache.emplace(5u).first);
+    CHECK(cache.size() == 4);
+    CHECK(evicted.values == std::vector<uint32_t>{0, 3});
+    CHECK(cache.contains(refs[2]));
+    CHECK(cache.peek(refs[2])->a == 2);
+
+    // Costs can be sizes in bytes instead of counts
+    cache.set_budget(100);
+    auto big = cache.emplace_with_cost(90, 6u);
+    REQUIRE(big.second != nullptr);
+    CHECK(cache.total_cost() <= 100);
+    CHECK(cache.emplace_with_cost(101, 7u).second == nullptr);
+
+    // Shrinking the budget evicts right away
+    uint32_t evicted_before = (uint32_t) evicted.values.size();
+    cache.set_budget(1);
+    CHECK(cache.size() <= 1);
+    CHECK(evicted.values.size() > evicted_before);
+
+    // Explicit releases don't call the eviction callback
+    evicted_before = (uint32_t) evicted.values.size();
+    cache.set_budget(10);
+    auto ref = cache.emplace(8u).first;
+    CHECK(cache.release(ref));
+    CHECK(!cache.release(ref));
+    CHECK(evicted.values.size() == evicted_before);
+}
+
+TEST_CASE("gen_arena_timer_wheel_test") {
+    using Ref = GenArena<Obj>::Ref;
+    GenArena<Obj> sessions;
+    GenArenaTimerWheel<Obj> wheel(sessions, 1000);
+
+    // TTLs across all levels of the wheel (and beyond them)
+    const uint32_t ttls[] = {0, 1, 5, 63, 64, 65, 100, 4095, 4096, 5000, 300000, 20000000, 40000000};
+    std::vector<Ref> refs;
+    for (uint32_t ttl : ttls) {
+        Ref ref = sessions.emplace(ttl).first;
+        wheel.schedule_after(ref, ttl);
+        refs.push_back(ref);
+    }
+    // Reschedule one, cancel one, and release one directly (which leaves a stale wheel entry)
+    wheel.schedule(refs[2], 1000 + 10);
+    CHECK(wheel.cancel(refs[3]));
+    CHECK(!wheel.cancel(refs[3]));
+    sessions.release(refs[4]);
+    CHECK(wheel.size() == 12);
+
+    auto expect_alive = [&](uint64_t now) {
+        for (uint32_t i = 0; i < refs.size(); i++) {
+            uint64_t expiry = i == 2 ? 1010 : 1000 + ttls[i];
+            bool alive = i == 3 || (i != 4 && expiry > now);
+            CHECK(sessions.is_valid_ref(refs[i]) == alive);
+        }
+    };
+
+    CHECK(wheel.advance(1000) == 1);
+    expect_alive(1000);
+    CHECK(wheel.advance(1005) == 1);
+    expect_alive(1005);
+    CHECK(wheel.advance(1009) == 0);
+    CHECK(wheel.advance(1010) == 1);
+    expect_alive(1010);
+
+    const uint64_t steps[] = {1064, 1065, 1099, 1100, 5095, 5096, 6000, 301000, 20001000, 40001000};
+    for (uint64_t now : steps) {
+        wheel.advance(now);
+        CHECK(wheel.now() == now);
+        expect_alive(now);
+    }
+    CHECK(wheel.size() == 0);
+    CHECK(sessions.size() == 1);
+}
+
+TEST_CASE("gen_arena_timer_wheel_jump_test") {
+    using Ref = GenArena<Obj>::Ref;
+    GenArena<Obj> sessions;
+    GenArenaTimerWheel<Obj> wheel(sessions);
+
+    // Cancelled and rescheduled entries stay in the wheel, but advance() only visits the slots that hold entries,
+    // so jumping far ahead doesn't step through every tick
+    std::vector<Ref> refs;
+    for (uint32_t i = 0; i < 1000; i++) {
+        Ref ref = sessions.emplace(i).first;
+        wheel.schedule_after(ref, 1ull << (i % 38));
+        refs.push_back(ref);
+    }
+    for (uint32_t i = 0; i < 1000; i += 2) {
+        wheel.cancel(refs[i]);
+    }
+    for (uint32_t i = 1; i < 1000; i += 4) {
+        wheel.schedule(refs[i], 1ull << 39);
+    }
+    CHECK(wheel.advance(1ull << 38) == 250);
+    CHECK(sessions.size() == 750);
+    CHECK(wheel.advance(1ull << 39) == 250);
+    CHECK(sessions.size() == 500);
+    CHECK(wheel.size() == 0);
+    CHECK(wheel.advance(1ull << 42) == 0);
+    CHECK(wheel.now() == 1ull << 42);
+
+    // Random deadlines, checked against the time each item should expire at
+    std::mt19937 rng(7);
+    std::vector<uint64_t> expiries(refs.size(), UINT64_MAX);
+    for (uint32_t i = 0; i < 500; i++) {
+        if (!sessions.is_valid_ref(refs[i])) {
+            refs[i] = sessions.emplace(i).first;
+        }
+        uint64_t ttl = rng() % (1u << (rng() % 27));
+        expiries[i] = wheel.now() + ttl;
+        wheel.schedule(refs[i], expiries[i]);
+    }
+    uint64_t now = wheel.now();
+    while (wheel.size() > 0) {
+        now += rng() % 100000;
+        wheel.advance(now);
+        uint32_t wrong = 0;
+        for (uint32_t i = 0; i < 500; i++) {
+            wrong += sessions.is_valid_ref(refs[i]) != (expiries[i] > now);
+        }
+        CHECK(wrong == 0);
+    }
+}
+
+TEST_CASE("gen_arena_memory_report_test") {
+    GenArena<Obj> arena;
+
+    std::vector<GenArena<Obj>::Ref> refs;
+    for (uint32_t i = 0; i < 100; i++) {
+        refs.push_back(arena.emplace(i).first);
+    }
+    GenArenaMemoryReport report = arena.memory_report();
+    CHECK(report.item_bytes_reserved == sizeof(Obj) * 128);
+    CHECK(report.item_bytes_used == sizeof(Obj) * 100);
+    CHECK(report.metadata_bytes_used == sizeof(GenArenaMetadata) * 100);
+    CHECK(report.sparse_bytes_used == sizeof(GenArena<Obj>::Ref) * 100);
+    CHECK(report.total_bytes_used == report.item_bytes_used + report.metadata_bytes_used + report.sparse_bytes_used);
+    CHECK(report.live_ratio == 1.0);
+    CHECK(report.sparse_to_dense_ratio == 1.0);
+    CHECK(report.locality == 1.0); // Nothing was released, so the dense order is the slot order
+
+    // Releasing every other item from the front swaps items from the back into the holes
+    for (uint32_t i = 0; i < 50; i += 2) {
+        arena.release(refs[i]);
+    }
+    report = arena.memory_report();
+    CHECK(arena.size() == 75);
+    CHECK(report.live_ratio == doctest::Approx(0.75));
+    CHECK(report.sparse_to_dense_ratio == doctest::Approx(100.0 / 75));
+    CHECK(report.locality < 0.8);
+
+    char buf[512];
+    int len = gen_arena_memory_report_to_text(report, "objs", buf, sizeof(buf));
+    REQUIRE((len > 0 && len < (int) sizeof(buf)));
+    CHECK(std::string(buf).find("objs: ") == 0);
+}